@@ -0,0 +1,121 @@
+#pragma once
+#include <array>
+#include <charconv>
+#include <iterator>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace format {
+
+// Точность по умолчанию для вещественных чисел, как у std::ostream
+inline constexpr int DEFAULT_PRECISION = 6;
+
+namespace detail {
+
+template <typename Number>
+std::to_chars_result ToChars(char* first, char* last, Number value, int precision) {
+    if constexpr (std::is_floating_point_v<Number>) {
+        return std::to_chars(first, last, value, std::chars_format::general, precision);
+    }
+    else {
+        return std::to_chars(first, last, value);
+    }
+}
+
+} // namespace detail
+
+/*
+ * Выводит число в поток через std::to_chars, минуя локале-зависимое форматирование ostream.
+ * Вещественные числа печатаются в формате %g с точностью потока,
+ * поэтому при флагах по умолчанию результат совпадает с выводом operator<<
+ */
+template <typename Number>
+void WriteNumber(std::ostream& out, Number value) {
+    char buffer[32];
+    const auto result = detail::ToChars(std::begin(buffer), std::end(buffer), value,
+                                        static_cast<int>(out.precision()));
+    if (result.ec != std::errc{}) {
+        // Буфера не хватило (например, при очень большой точности потока)
+        out << value;
+        return;
+    }
+    out.write(buffer, result.ptr - buffer);
+}
+
+// Дописывает число в конец строки в том же формате, что и WriteNumber
+template <typename Number>
+void AppendNumber(std::string& out, Number value, int precision = DEFAULT_PRECISION) {
+    char buffer[32];
+    const auto result = detail::ToChars(std::begin(buffer), std::end(buffer), value, precision);
+    if (result.ec != std::errc{}) {
+        std::ostringstream os;
+        os.precision(precision);
+        os << value;
+        out += os.str();
+        return;
+    }
+    out.append(buffer, result.ptr);
+}
+
+namespace detail {
+
+struct AppendData {
+    void operator()(std::string& out, std::string_view data) const {
+        out.append(data);
+    }
+};
+
+} // namespace detail
+
+/*
+ * Поток вывода, который дописывает данные в строку out блоками через append(out, block).
+ * В отличие от std::ostringstream, данные сразу попадают в строку владельца
+ * и не копируются при получении результата; append может преобразовывать их по пути.
+ * Остаток буфера дописывается вызовом Flush
+ */
+template <typename Append = detail::AppendData>
+class StringStream : private std::streambuf, public std::ostream {
+public:
+    explicit StringStream(std::string& out, Append append = {})
+        : std::ostream(this)
+        , out_(out)
+        , append_(std::move(append)) {
+        setp(buffer_.data(), buffer_.data() + buffer_.size());
+    }
+
+    StringStream(const StringStream&) = delete;
+    StringStream& operator=(const StringStream&) = delete;
+
+    void Flush() {
+        append_(out_, std::string_view(pbase(), pptr() - pbase()));
+        setp(buffer_.data(), buffer_.data() + buffer_.size());
+    }
+
+private:
+    static constexpr size_t BUFFER_SIZE = 4096;
+
+    std::string& out_;
+    Append append_;
+    std::array<char, BUFFER_SIZE> buffer_;
+
+    using Traits = std::streambuf::traits_type;
+
+    std::streambuf::int_type overflow(std::streambuf::int_type ch) override {
+        Flush();
+        if (!Traits::eq_int_type(ch, Traits::eof())) {
+            sputc(Traits::to_char_type(ch));
+        }
+        return Traits::not_eof(ch);
+    }
+
+    int sync() override {
+        Flush();
+        return 0;
+    }
+};
+
+} // namespace format
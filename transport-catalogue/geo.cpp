@@ -9,9 +9,8 @@ double ComputeDistance(Coordinates from, Coordinates to) {
         return 0;
     }
     static const double dr = M_PI / 180.;
-    const int r_earth = 6371000;
     return acos(sin(from.lat * dr) * sin(to.lat * dr)
-        + cos(from.lat * dr) * cos(to.lat * dr) * cos(abs(from.lng - to.lng) * dr)) * r_earth;
+        + cos(from.lat * dr) * cos(to.lat * dr) * cos(abs(from.lng - to.lng) * dr)) * EARTH_RADIUS;
 }
 
 } // namespace geo
\ No newline at end of file
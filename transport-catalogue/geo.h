@@ -1,8 +1,12 @@
 #pragma once
+#include <algorithm>
 #include <cmath>
 
 namespace geo {
 
+// радиус Земли в метрах, которым пользуется ComputeDistance
+inline constexpr double EARTH_RADIUS = 6371000.0;
+
 struct Coordinates {
     double lat = 0.0;
     double lng = 0.0;
@@ -15,6 +19,27 @@ struct Coordinates {
     }
 };
 
+// прямоугольная область в географических координатах
+struct Bounds {
+    // наименьшие широта и долгота
+    Coordinates min;
+    // наибольшие широта и долгота
+    Coordinates max;
+
+    bool Contains(Coordinates point) const {
+        return point.lat >= min.lat && point.lat <= max.lat
+            && point.lng >= min.lng && point.lng <= max.lng;
+    }
+
+    // Расширяет область так, чтобы она содержала point
+    void Extend(Coordinates point) {
+        min.lat = std::min(min.lat, point.lat);
+        min.lng = std::min(min.lng, point.lng);
+        max.lat = std::max(max.lat, point.lat);
+        max.lng = std::max(max.lng, point.lng);
+    }
+};
+
 double ComputeDistance(Coordinates from, Coordinates to);
 
 } // namespace geo
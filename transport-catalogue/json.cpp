@@ -1,3 +1,4 @@
+#include "format.h"
 #include "json.h"
 
 #include <numeric>
@@ -94,7 +95,7 @@ Node::Value& Node::GetValue() {
 
 namespace detail {
 
-Node LoadNode(std::istream& input);
+Node LoadNode(std::istream& input, std::pmr::memory_resource* resource);
 
 Node LoadToken(std::istream& input) {
     std::string token;
@@ -188,7 +189,7 @@ Node LoadNumber(std::istream& input) {
 
 // Считывает содержимое строкового литерала JSON-документа
 // Функцию следует использовать после считывания открывающего символа ":
-Node LoadString(std::istream& input) {
+std::string LoadStringContent(std::istream& input) {
 
     auto it = std::istreambuf_iterator<char>(input);
     auto end = std::istreambuf_iterator<char>();
@@ -245,17 +246,21 @@ Node LoadString(std::istream& input) {
         ++it;
     }
 
-    return Node(move(s));
+    return s;
+}
+
+Node LoadString(std::istream& input) {
+    return Node(LoadStringContent(input));
 }
 
-Node LoadArray(std::istream& input) {
-    Array result;
+Node LoadArray(std::istream& input, std::pmr::memory_resource* resource) {
+    Array result(resource);
 
     for (char c; input >> c && c != ']';) {
         if (c != ',') {
             input.putback(c);
         }
-        result.push_back(LoadNode(input));
+        result.push_back(LoadNode(input, resource));
     }
     if (!input) {
         throw ParsingError("Array parsing error"s);
@@ -263,8 +268,8 @@ Node LoadArray(std::istream& input) {
     return Node(move(result));
 }
 
-Node LoadDict(std::istream& input) {
-    Dict result;
+Node LoadDict(std::istream& input, std::pmr::memory_resource* resource) {
+    Dict result(resource);
 
     for (char c; input >> c && c != '}';) {
         if (c == ',') {
@@ -272,12 +277,12 @@ Node LoadDict(std::istream& input) {
         }
         std::string key;
         if (c == '"') {
-            key = LoadString(input).AsString();
+            key = LoadStringContent(input);
         }
         if (key.empty() || !(input >> c) || c != ':') {
             throw ParsingError("Dictionary key/value parsing error"s);
         }
-        result.insert({ move(key), LoadNode(input) });
+        result.insert({ move(key), LoadNode(input, resource) });
     }
     if (!input) {
         throw ParsingError("Dictionary parsing error"s);
@@ -285,17 +290,17 @@ Node LoadDict(std::istream& input) {
     return Node(move(result));
 }
 
-Node LoadNode(std::istream& input) {
+Node LoadNode(std::istream& input, std::pmr::memory_resource* resource) {
     char c;
     if (!(input >> c)) {
         throw ParsingError("The unexpected end of the stream"s);
     }
 
     if (c == '[') {
-        return LoadArray(input);
+        return LoadArray(input, resource);
     }
     else if (c == '{') {
-        return LoadDict(input);
+        return LoadDict(input, resource);
     }
     else if (c == '"') {
         return LoadString(input);
@@ -320,27 +325,23 @@ void PrintValue(std::nullptr_t, const PrintContext& ctx) {
 }
 
 void PrintValue(bool value, const PrintContext& ctx) {
-    ctx.out << std::boolalpha << value;
+    ctx.out << (value ? "true"sv : "false"sv);
+}
+
+void PrintValue(int value, const PrintContext& ctx) {
+    format::WriteNumber(ctx.out, value);
+}
+
+void PrintValue(double value, const PrintContext& ctx) {
+    format::WriteNumber(ctx.out, value);
 }
 
 void PrintValue(const std::string& value, const PrintContext& ctx) {
-    static const std::map<char, std::string_view> ctos = {
-        { '\n', "\\n"sv },
-        { '\r', "\\r"sv },
-        { '\t', "\\t"sv },
-        { '\"', "\\\""sv },
-        { '\\', "\\\\"sv }
-    };
     auto& out = ctx.out;
     out.put('"');
-    for (const char c : value) {
-        if (auto it = ctos.find(c); it != ctos.end()) {
-            out << it->second;
-        }
-        else {
-            out.put(c);
-        }
-    }
+    detail::ForEachEscapedPart(value, [&out](std::string_view part) {
+        out.write(part.data(), part.size());
+    });
     out.put('"');
 }
 
@@ -393,6 +394,228 @@ void PrintNode(const Node& node, const PrintContext& ctx) {
 
 } // namespace output
 
+Reader::Reader(std::istream& input, std::pmr::memory_resource* resource)
+    : input_(input)
+    , resource_(resource) {
+}
+
+char Reader::ReadChar() {
+    char c;
+    if (!(input_ >> c)) {
+        throw ParsingError("The unexpected end of the stream"s);
+    }
+    return c;
+}
+
+void Reader::BeginArray() {
+    if (ReadChar() != '[') {
+        throw ParsingError("Array is expected"s);
+    }
+    closers_.push_back(']');
+}
+
+void Reader::BeginDict() {
+    if (ReadChar() != '{') {
+        throw ParsingError("Dictionary is expected"s);
+    }
+    closers_.push_back('}');
+}
+
+bool Reader::Next() {
+    if (closers_.empty()) {
+        throw ParsingError("No array or dictionary is open"s);
+    }
+    const char c = ReadChar();
+    if (c == ']' || c == '}') {
+        if (c != closers_.back()) {
+            throw ParsingError("Unexpected "s + c);
+        }
+        closers_.pop_back();
+        return false;
+    }
+    if (c != ',') {
+        input_.putback(c);
+    }
+    return true;
+}
+
+std::string Reader::ReadKey() {
+    std::string key;
+    if (ReadChar() == '"') {
+        key = detail::LoadStringContent(input_);
+    }
+    if (key.empty() || ReadChar() != ':') {
+        throw ParsingError("Dictionary key/value parsing error"s);
+    }
+    return key;
+}
+
+std::string Reader::ReadString() {
+    const char c = ReadChar();
+    if (c == '"') {
+        return detail::LoadStringContent(input_);
+    }
+    input_.putback(c);
+    // Для значения другого типа бросаем то же исключение, что и Node::AsString
+    return ReadNode().AsString();
+}
+
+int Reader::ReadInt() {
+    return ReadNode().AsInt();
+}
+
+double Reader::ReadDouble() {
+    return ReadNode().AsDouble();
+}
+
+bool Reader::ReadBool() {
+    return ReadNode().AsBool();
+}
+
+Node Reader::ReadNode() {
+    return detail::LoadNode(input_, resource_);
+}
+
+void Reader::Skip() {
+    // Пропущенное значение сразу уничтожается, поэтому не занимаем под него арену
+    detail::LoadNode(input_, std::pmr::get_default_resource());
+}
+
+std::string Reader::ReadRaw() {
+    std::string result(1, ReadChar());
+    const char first = result.front();
+
+    if (first != '[' && first != '{' && first != '"') {
+        // Число или литерал: читаем до ближайшего разделителя
+        while (input_ && input_.peek() != EOF && !std::isspace(input_.peek())
+               && input_.peek() != ',' && input_.peek() != ']' && input_.peek() != '}') {
+            result.push_back(static_cast<char>(input_.get()));
+        }
+        return result;
+    }
+
+    auto it = std::istreambuf_iterator<char>(input_);
+    const auto end = std::istreambuf_iterator<char>();
+    int depth = first == '"' ? 0 : 1;
+    bool in_string = first == '"';
+    bool escaped = false;
+
+    while (in_string || depth > 0) {
+        if (it == end) {
+            throw ParsingError("The unexpected end of the stream"s);
+        }
+        const char c = *it++;
+        result.push_back(c);
+        if (in_string) {
+            if (escaped) {
+                escaped = false;
+            }
+            else if (c == '\\') {
+                escaped = true;
+            }
+            else if (c == '"') {
+                in_string = false;
+            }
+        }
+        else if (c == '"') {
+            in_string = true;
+        }
+        else if (c == '[' || c == '{') {
+            ++depth;
+        }
+        else if (c == ']' || c == '}') {
+            --depth;
+        }
+    }
+    return result;
+}
+
+char Reader::Peek() {
+    const char c = ReadChar();
+    input_.putback(c);
+    return c;
+}
+
+size_t Reader::GetDepth() const {
+    return closers_.size();
+}
+
+void Reader::SkipTo(size_t depth) {
+    while (closers_.size() > depth) {
+        const bool is_dict = closers_.back() == '}';
+        // Next закрывает контейнер, когда он заканчивается
+        if (Next()) {
+            if (is_dict) {
+                ReadKey();
+            }
+            Skip();
+        }
+    }
+}
+
+std::vector<std::string_view> SplitArray(ViewStream& input) {
+    std::string_view array = input.GetRest();
+    const auto is_space = [](char c) { return std::isspace(static_cast<unsigned char>(c)) != 0; };
+    while (!array.empty() && is_space(array.front())) {
+        array.remove_prefix(1);
+    }
+    if (array.empty() || array.front() != '[') {
+        throw ParsingError("Array is expected"s);
+    }
+    std::vector<std::string_view> result;
+    const auto add_element = [&](size_t begin, size_t end) {
+        while (begin < end && is_space(array[begin])) {
+            ++begin;
+        }
+        while (end > begin && is_space(array[end - 1])) {
+            --end;
+        }
+        if (begin != end) {
+            result.push_back(array.substr(begin, end - begin));
+        }
+    };
+
+    int depth = 0;
+    bool in_string = false;
+    bool escaped = false;
+    size_t element_begin = 0;
+
+    for (size_t i = 0; i < array.size(); ++i) {
+        const char c = array[i];
+        if (in_string) {
+            if (escaped) {
+                escaped = false;
+            }
+            else if (c == '\\') {
+                escaped = true;
+            }
+            else if (c == '"') {
+                in_string = false;
+            }
+        }
+        else if (c == '"') {
+            in_string = true;
+        }
+        else if (c == '[' || c == '{') {
+            if (depth++ == 0) {
+                element_begin = i + 1;
+            }
+        }
+        else if (c == ']' || c == '}') {
+            if (--depth == 0) {
+                add_element(element_begin, i);
+                input.Advance(input.GetRest().size() - array.size() + i + 1);
+                return result;
+            }
+        }
+        else if (c == ',' && depth == 1) {
+            add_element(element_begin, i);
+            element_begin = i + 1;
+        }
+    }
+    throw ParsingError("Array parsing error"s);
+}
+
 Document::Document(Node root)
     : root_(std::move(root)) {
 }
@@ -405,8 +628,8 @@ bool Document::operator==(const Document& other) const {
     return root_ == other.root_;
 }
 
-Document Load(std::istream& input) {
-    return Document{ detail::LoadNode(input) };
+Document Load(std::istream& input, std::pmr::memory_resource* resource) {
+    return Document{ detail::LoadNode(input, resource) };
 }
 
 void Print(const Document& doc, std::ostream& out) {
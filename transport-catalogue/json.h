@@ -1,15 +1,20 @@
 #pragma once
+#include <array>
 #include <iostream>
 #include <map>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <variant>
 #include <vector>
 
 namespace json {
 
 class Node;
-using Dict = std::map<std::string, Node>;
-using Array = std::vector<Node>;
+// Контейнеры используют полиморфный аллокатор, поэтому всё дерево документа
+// может размещаться в одной арене (см. Load)
+using Dict = std::pmr::map<std::string, Node>;
+using Array = std::pmr::vector<Node>;
 
 class ParsingError : public std::runtime_error {
 public:
@@ -65,6 +70,109 @@ inline bool operator!=(const Document& lhs, const Document& rhs) {
     return !(lhs == rhs);
 }
 
+/*
+ * Потоковое чтение JSON без построения дерева Node.
+ * Позволяет разбирать документ по известной схеме, загружая в Node только нужные части
+ */
+class Reader {
+public:
+    explicit Reader(std::istream& input,
+                    std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+    void BeginArray();
+    void BeginDict();
+    // Переходит к следующему элементу текущего массива или словаря.
+    // Возвращает false, если контейнер закончился
+    bool Next();
+    // Считывает ключ словаря вместе с последующим ':'
+    std::string ReadKey();
+
+    std::string ReadString();
+    int ReadInt();
+    double ReadDouble();
+    bool ReadBool();
+    Node ReadNode();
+    // Пропускает очередное значение
+    void Skip();
+    // Считывает исходный текст очередного значения, не разбирая его
+    std::string ReadRaw();
+    // Следующий непробельный символ; он не считывается
+    char Peek();
+    // Число открытых массивов и словарей
+    size_t GetDepth() const;
+    // Пропускает остаток открытых контейнеров, пока их не останется depth.
+    // Поток должен стоять между значениями: значения читаются целиком,
+    // поэтому так бывает после любой ошибки, кроме ParsingError
+    void SkipTo(size_t depth);
+
+private:
+    std::istream& input_;
+    std::pmr::memory_resource* resource_;
+    std::vector<char> closers_;
+
+    char ReadChar();
+};
+
+/*
+ * Поток ввода, читающий символы непосредственно из строки без её копирования.
+ * Строка должна существовать всё время работы с потоком
+ */
+class ViewStream : private std::streambuf, public std::istream {
+public:
+    explicit ViewStream(std::string_view str)
+        : std::istream(this) {
+        char* data = const_cast<char*>(str.data());
+        setg(data, data, data + str.size());
+    }
+
+    // Ещё не прочитанная часть строки
+    std::string_view GetRest() const {
+        return { gptr(), static_cast<size_t>(egptr() - gptr()) };
+    }
+
+    // Пропускает count ещё не прочитанных символов
+    void Advance(size_t count) {
+        setg(eback(), gptr() + count, egptr());
+    }
+};
+
+// Считывает из input JSON-массив и разбивает его на тексты элементов верхнего уровня, не разбирая их.
+// Элементы ссылаются на строку, из которой читает input
+std::vector<std::string_view> SplitArray(ViewStream& input);
+
+namespace detail {
+
+// Замены символов в строковом литерале JSON; пустая строка — символ выводится как есть
+constexpr std::array<std::string_view, 256> MakeEscapes() {
+    std::array<std::string_view, 256> escapes{};
+    escapes['\n'] = "\\n";
+    escapes['\r'] = "\\r";
+    escapes['\t'] = "\\t";
+    escapes['"'] = "\\\"";
+    escapes['\\'] = "\\\\";
+    return escapes;
+}
+
+inline constexpr std::array<std::string_view, 256> ESCAPES = MakeEscapes();
+
+// Передаёт write части записи str в строковом литерале JSON (без кавычек):
+// участки, которые выводятся как есть, и замены спецсимволов
+template <typename Write>
+void ForEachEscapedPart(std::string_view str, Write write) {
+    size_t begin = 0;
+    for (size_t i = 0; i < str.size(); ++i) {
+        const std::string_view escape = ESCAPES[static_cast<unsigned char>(str[i])];
+        if (!escape.empty()) {
+            write(str.substr(begin, i - begin));
+            write(escape);
+            begin = i + 1;
+        }
+    }
+    write(str.substr(begin));
+}
+
+} // namespace detail
+
 struct PrintContext {
     std::ostream& out;
     int indent_step = 4;
@@ -82,7 +190,11 @@ struct PrintContext {
     }
 };
 
-Document Load(std::istream& input);
+// Узлы документа выделяются из resource. Если передана арена (например,
+// std::pmr::monotonic_buffer_resource), документ не должен её пережить,
+// а память всего дерева освобождается одним вызовом release()
+Document Load(std::istream& input,
+              std::pmr::memory_resource* resource = std::pmr::get_default_resource());
 
 void Print(const Document& doc, std::ostream& output);
 
@@ -1,7 +1,13 @@
-#include "json_builder.h"
 #include "json_reader.h"
+#include "metrics.h"
+#include "parallel.h"
 
-#include <tuple>
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <optional>
+#include <variant>
 
 namespace json_reader {
 
@@ -11,50 +17,367 @@ using namespace std::literals;
 
 namespace detail {
 
-std::unordered_map<std::string_view, int> ConvertDict(const Dict& dict) {
-    return ConvertTo<std::unordered_map<std::string_view, int>>(
-        dict.begin(), dict.end(),
-        [](const auto& p) { return std::pair<std::string_view, int>{ p.first, p.second.AsInt() }; });
+// Минимальное число элементов base_requests, разбираемых отдельным потоком
+constexpr size_t MIN_CHUNK_SIZE = 1024;
+
+// Поля элемента base_requests. Тип запроса может идти после остальных полей,
+// поэтому до его появления разбираются поля обеих схем
+struct BaseRequestFields {
+    std::string type;
+    std::optional<std::string> name;
+    std::optional<double> latitude;
+    std::optional<double> longitude;
+    std::optional<std::vector<std::pair<std::string, int>>> road_distances;
+    std::optional<std::vector<std::string>> stops;
+    std::optional<bool> is_roundtrip;
+};
+
+std::vector<std::pair<std::string, int>> ReadRoadDistances(Reader& reader) {
+    std::vector<std::pair<std::string, int>> result;
+    reader.BeginDict();
+    while (reader.Next()) {
+        std::string stop = reader.ReadKey();
+        result.emplace_back(std::move(stop), reader.ReadInt());
+    }
+    return result;
+}
+
+std::vector<std::string> ReadStops(Reader& reader) {
+    std::vector<std::string> result;
+    reader.BeginArray();
+    while (reader.Next()) {
+        result.push_back(reader.ReadString());
+    }
+    return result;
+}
+
+BaseRequestFields ReadBaseRequestFields(Reader& reader) {
+    BaseRequestFields fields;
+    reader.BeginDict();
+    while (reader.Next()) {
+        const std::string key = reader.ReadKey();
+        const bool is_stop = fields.type.empty() || fields.type == "Stop"sv;
+        const bool is_bus = fields.type.empty() || fields.type == "Bus"sv;
+
+        if (key == "type"sv) {
+            fields.type = reader.ReadString();
+        }
+        else if (key == "name"sv && (is_stop || is_bus)) {
+            fields.name = reader.ReadString();
+        }
+        else if (key == "latitude"sv && is_stop) {
+            fields.latitude = reader.ReadDouble();
+        }
+        else if (key == "longitude"sv && is_stop) {
+            fields.longitude = reader.ReadDouble();
+        }
+        else if (key == "road_distances"sv && is_stop) {
+            fields.road_distances = ReadRoadDistances(reader);
+        }
+        else if (key == "stops"sv && is_bus) {
+            fields.stops = ReadStops(reader);
+        }
+        else if (key == "is_roundtrip"sv && is_bus) {
+            fields.is_roundtrip = reader.ReadBool();
+        }
+        else {
+            reader.Skip();
+        }
+    }
+    return fields;
 }
 
-std::vector<std::string_view> ConvertArray(const Array& arr) {
-    return ConvertTo<std::vector<std::string_view>>(
-        arr.begin(), arr.end(), [](const Node& stop) { return std::string_view{ stop.AsString() }; });
+// Разбирает и проверяет текст одного элемента base_requests
+BaseRequest ParseBaseRequest(std::string_view text) {
+    ViewStream input(text);
+    Reader reader(input);
+    BaseRequestFields fields = ReadBaseRequestFields(reader);
+
+    if (fields.type == "Stop"sv) {
+        if (!fields.name || !fields.latitude || !fields.longitude || !fields.road_distances) {
+            throw RequestError();
+        }
+        return StopRequest{
+            std::move(*fields.name),
+            geo::Coordinates{ *fields.latitude, *fields.longitude },
+            std::move(*fields.road_distances)
+        };
+    }
+    if (fields.type == "Bus"sv) {
+        if (!fields.name || !fields.stops || !fields.is_roundtrip) {
+            throw RequestError();
+        }
+        return BusRequest{ std::move(*fields.name), std::move(*fields.stops), *fields.is_roundtrip };
+    }
+    if (fields.type.empty()) {
+        throw RequestError();
+    }
+    return {};
 }
 
-using ParamsQueryStop = std::tuple<std::string_view, geo::Coordinates, std::unordered_map<std::string_view, int>>;
+// Разбирает base_requests сразу в параметры запросов, не строя дерево Node.
+// Элементы массива выделяются прямо в буфере входа и разбираются параллельно частями
+std::vector<BaseRequest> ReadBaseRequests(ViewStream& input, size_t thread_count) {
+    const std::vector<std::string_view> elements = SplitArray(input);
 
-ParamsQueryStop ParseStopRequest(const Dict& dict) {
-    return{
-        dict.at("name"s).AsString(),
-        geo::Coordinates{ dict.at("latitude"s).AsDouble(), dict.at("longitude"s).AsDouble() },
-        std::move(ConvertDict(dict.at("road_distances"s).AsDict()))
+    std::vector<BaseRequest> parsed(elements.size());
+    const auto parse_chunk = [&elements, &parsed](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            parsed[i] = ParseBaseRequest(elements[i]);
+        }
     };
+    parallel::ForEachChunk(elements.size(), MIN_CHUNK_SIZE, parse_chunk, thread_count);
+    return parsed;
 }
 
-using ParamsQueryBus = std::tuple<std::string_view, std::vector<std::string_view>, bool>;
+// Считывает вход целиком крупными блоками
+std::string ReadInput(std::istream& in) {
+    constexpr size_t BLOCK_SIZE = 1 << 16;
+    std::string result;
+    size_t size = 0;
+    do {
+        result.resize(size + BLOCK_SIZE);
+        in.read(result.data() + size, BLOCK_SIZE);
+        size += static_cast<size_t>(in.gcount());
+    } while (in);
+    result.resize(size);
+    return result;
+}
+
+// Разбирает границы области [min_lat, min_lng, max_lat, max_lng]. Область, обе стороны
+// которой меньше renderer::EPSILON, нельзя растянуть на изображение
+renderer::GeoBounds ReadBounds(Reader& reader) {
+    std::vector<double> values;
+    reader.BeginArray();
+    while (reader.Next()) {
+        values.push_back(reader.ReadDouble());
+    }
+    if (values.size() != 4 || values[0] > values[2] || values[1] > values[3]
+        || (renderer::IsZero(values[2] - values[0]) && renderer::IsZero(values[3] - values[1]))) {
+        throw RequestError();
+    }
+    return { { values[0], values[1] }, { values[2], values[3] } };
+}
+
+// Проверяет, что тайл существует при своём масштабе
+renderer::Tile CheckTile(int z, int x, int y) {
+    if (z < 0 || z > renderer::MAX_TILE_ZOOM) {
+        throw RequestError();
+    }
+    const long long count = 1LL << z;
+    if (x < 0 || y < 0 || x >= count || y >= count) {
+        throw RequestError();
+    }
+    return { z, x, y };
+}
 
-ParamsQueryBus ParseBusRequest(const Dict& dict) {
-    return{
-        dict.at("name"s).AsString(),
-        std::move(ConvertArray(dict.at("stops"s).AsArray())),
-        dict.at("is_roundtrip"s).AsBool()
+// Проверяет, что широта и долгота точки существуют
+geo::Coordinates CheckCoordinates(double latitude, double longitude) {
+    if (std::abs(latitude) > 90 || std::abs(longitude) > 180) {
+        throw RequestError();
+    }
+    return { latitude, longitude };
+}
+
+// Проверяет параметры запроса NearestStops. Без count ищутся все остановки в радиусе,
+// без radius — ближайшие на любом расстоянии
+StatRequest::NearestStops CheckNearestStops(double latitude, double longitude,
+                                            std::optional<int> count, std::optional<double> radius) {
+    if ((count && *count <= 0) || (radius && !(*radius >= 0))) {
+        throw RequestError();
+    }
+    return {
+        CheckCoordinates(latitude, longitude),
+        count ? static_cast<size_t>(*count) : std::numeric_limits<size_t>::max(),
+        radius ? *radius : std::numeric_limits<double>::infinity()
     };
 }
 
-StatRequest ParseStatRequest(const Dict& dict) {
-    StatRequest result;
-    for (const auto& [key, val] : dict) {
+// Разбирает место маршрута: название остановки или точку {"latitude", "longitude"}
+routemap::Place ReadPlace(Reader& reader, std::deque<std::string>& strings) {
+    const Node node = reader.ReadNode();
+    if (node.IsString()) {
+        return strings.emplace_back(node.AsString());
+    }
+    if (!node.IsDict()) {
+        throw RequestError();
+    }
+    const Dict& dict = node.AsDict();
+    const auto latitude = dict.find("latitude"s);
+    const auto longitude = dict.find("longitude"s);
+    if (latitude == dict.end() || longitude == dict.end()
+        || !latitude->second.IsDouble() || !longitude->second.IsDouble()) {
+        throw RequestError();
+    }
+    return CheckCoordinates(latitude->second.AsDouble(), longitude->second.AsDouble());
+}
+
+// Разбирает запрос из элемента stat_requests; id сохраняется в id, как только прочитан
+decltype(StatRequest::query) ReadStatQuery(Reader& reader, std::deque<std::string>& strings,
+                                           std::optional<int>& id) {
+    if (reader.Peek() != '{') {
+        reader.Skip();
+        throw RequestError("Dictionary is expected"s);
+    }
+    std::string type;
+    std::optional<std::string_view> name;
+    std::optional<routemap::Place> from;
+    std::optional<routemap::Place> to;
+    std::optional<int> z;
+    std::optional<int> x;
+    std::optional<int> y;
+    std::optional<renderer::GeoBounds> bbox;
+    std::optional<double> latitude;
+    std::optional<double> longitude;
+    std::optional<int> count;
+    std::optional<double> radius;
+
+    reader.BeginDict();
+    while (reader.Next()) {
+        const std::string key = reader.ReadKey();
         if (key == "id"sv) {
-            result.id = val.AsInt();
+            id = reader.ReadInt();
+        }
+        else if (key == "type"sv) {
+            type = reader.ReadString();
+        }
+        else if (key == "name"sv) {
+            name = strings.emplace_back(reader.ReadString());
+        }
+        else if (key == "from"sv) {
+            from = ReadPlace(reader, strings);
+        }
+        else if (key == "to"sv) {
+            to = ReadPlace(reader, strings);
+        }
+        else if (key == "z"sv) {
+            z = reader.ReadInt();
+        }
+        else if (key == "x"sv) {
+            x = reader.ReadInt();
+        }
+        else if (key == "y"sv) {
+            y = reader.ReadInt();
+        }
+        else if (key == "bbox"sv) {
+            bbox = ReadBounds(reader);
+        }
+        else if (key == "latitude"sv) {
+            latitude = reader.ReadDouble();
+        }
+        else if (key == "longitude"sv) {
+            longitude = reader.ReadDouble();
+        }
+        else if (key == "count"sv) {
+            count = reader.ReadInt();
+        }
+        else if (key == "radius"sv) {
+            radius = reader.ReadDouble();
+        }
+        else {
+            reader.Skip();
+        }
+    }
+
+    if (type == "Stop"sv && name) {
+        return StatRequest::Stop{ *name };
+    }
+    else if (type == "Bus"sv && name) {
+        return StatRequest::Bus{ *name };
+    }
+    else if (type == "Map"sv) {
+        return StatRequest::Map{};
+    }
+    else if (type == "Route"sv && from && to) {
+        const auto* from_stop = std::get_if<std::string_view>(&*from);
+        const auto* to_stop = std::get_if<std::string_view>(&*to);
+        if (from_stop && to_stop) {
+            return StatRequest::Route{ *from_stop, *to_stop };
         }
         else {
-            result.params[key] = val.AsString();
+            return StatRequest::WalkRoute{ *from, *to };
         }
     }
+    else if (type == "Stats"sv) {
+        return StatRequest::Stats{};
+    }
+    else if (type == "MapArea"sv && z && x && y && !bbox) {
+        return StatRequest::MapArea{ CheckTile(*z, *x, *y) };
+    }
+    else if (type == "MapArea"sv && bbox && !z && !x && !y) {
+        return StatRequest::MapArea{ *bbox };
+    }
+    else if (type == "NearestStops"sv && latitude && longitude && (count || radius)) {
+        return CheckNearestStops(*latitude, *longitude, count, radius);
+    }
+    throw RequestError();
+}
+
+// Разбирает элемент stat_requests. Строки запроса сохраняются в strings.
+// Ошибка в запросе не прерывает пакет: запрос дочитывается и становится StatRequest::Invalid.
+// ParsingError пробрасывается: после синтаксической ошибки границы запросов неизвестны
+StatRequest ReadStatRequest(Reader& reader, std::deque<std::string>& strings) {
+    const size_t depth = reader.GetDepth();
+    std::optional<int> id;
+    StatRequest result;
+    try {
+        result.query = ReadStatQuery(reader, strings, id);
+    }
+    catch (const ParsingError&) {
+        throw;
+    }
+    catch (const std::exception& e) {
+        reader.SkipTo(depth);
+        result.query = StatRequest::Invalid{ strings.emplace_back(e.what()), id.has_value() };
+    }
+    result.id = id.value_or(0);
     return result;
 }
 
+/*
+ * Источник stat-запросов: разбирает массив stat_requests из потока блоками, не строя дерево Node.
+ * На синтаксической ошибке чтение останавливается, и она становится последним запросом
+ */
+class StatRequestParser {
+public:
+    // reader должен стоять перед массивом stat_requests
+    explicit StatRequestParser(Reader& reader)
+        : reader_(reader) {
+        reader_.BeginArray();
+    }
+
+    bool operator()(StatBlock& block) {
+        block.requests.clear();
+        block.strings.clear();
+        while (!is_finished_ && block.requests.size() < STAT_BLOCK_SIZE) {
+            try {
+                if (!reader_.Next()) {
+                    is_finished_ = true;
+                    break;
+                }
+                block.requests.push_back(ReadStatRequest(reader_, block.strings));
+            }
+            catch (const ParsingError& e) {
+                // Следующие запросы уже не прочитать: ошибка становится последним ответом пакета
+                is_finished_ = true;
+                is_broken_ = true;
+                block.requests.push_back({ 0, StatRequest::Invalid{ block.strings.emplace_back(e.what()) } });
+            }
+        }
+        return !block.requests.empty();
+    }
+
+    // Чтение массива прервано синтаксической ошибкой
+    bool IsBroken() const {
+        return is_broken_;
+    }
+
+private:
+    Reader& reader_;
+    bool is_finished_ = false;
+    bool is_broken_ = false;
+};
+
 svg::Color ConvertToColor(const Node& node) {
     if (node.IsArray()) {
         const Array& arr = node.AsArray();
@@ -103,22 +426,37 @@ const Node& JsonReader::GetNodeRequest(const std::string& name) const {
     throw RequestError();
 }
 
-void JsonReader::LoadData() const {
-    const Array& base_requests = GetNodeRequest("base_requests"s).AsArray();
+void JsonReader::LoadData(std::istream& in) {
+    const metrics::ScopedTiming timing(metrics::Timing::CATALOGUE_LOAD);
+    // Вход читается в память целиком, чтобы base_requests разбирались из него без копирования
+    const std::string text = ReadInput(in);
+    ViewStream input(text);
+    Reader reader(input, &arena_);
+    Dict requests(&arena_);
+    std::optional<std::vector<BaseRequest>> base_requests;
 
-    BaseQueryHandler queries;
-
-    for (const auto& request : base_requests) {
-        const Dict& dict = request.AsDict();
-        std::string_view type = dict.at("type"s).AsString();
-        if (type == "Stop"sv) {
-            queries.AddBaseQuery(TryCatch(ParseStopRequest, dict));
+    // base_requests разбираются по схеме, stat_requests сохраняются текстом, остальные разделы — в data_
+    reader.BeginDict();
+    while (reader.Next()) {
+        std::string key = reader.ReadKey();
+        if (key == "base_requests"sv) {
+            base_requests = ReadBaseRequests(input, handler_.GetThreadCount());
+        }
+        else if (key == "stat_requests"sv) {
+            // Запросы разбираются конвейером вместе с их выполнением (см. PrintStatRequest)
+            stat_requests_ = reader.ReadRaw();
         }
-        if (type == "Bus"sv) {
-            queries.AddBaseQuery(TryCatch(ParseBusRequest, dict));
+        else {
+            requests.emplace(std::move(key), reader.ReadNode());
         }
     }
-    handler_.ProcessBaseQuery(queries);
+    data_ = Document(Node(std::move(requests)));
+
+    if (!base_requests) {
+        throw RequestError();
+    }
+
+    handler_.ProcessBaseQuery(*base_requests);
 }
 
 renderer::RenderSettings JsonReader::ParseRenderSettings() const {
@@ -138,6 +476,15 @@ renderer::RenderSettings JsonReader::ParseRenderSettings() const {
         setting.underlayer_color = ConvertToColor(dict.at("underlayer_color"s));
         setting.underlayer_width = dict.at("underlayer_width"s).AsDouble();
         setting.color_palette = std::move(ConvertToArrayColor(dict.at("color_palette"s).AsArray()));
+        if (const auto it = dict.find("simplify_tolerance"s); it != dict.end()) {
+            setting.simplify_tolerance = it->second.AsDouble();
+            if (!(setting.simplify_tolerance >= 0)) {
+                throw RequestError("Invalid renderer settings");
+            }
+        }
+        if (const auto it = dict.find("compact_svg"s); it != dict.end()) {
+            setting.compact_svg = it->second.AsBool();
+        }
     }
     catch (std::out_of_range const&) {
         throw RequestError("Invalid renderer settings");
@@ -155,6 +502,18 @@ routemap::RoutingSettings JsonReader::ParseRoutingSettings() const {
     try {
         settings.bus_wait_time = dict.at("bus_wait_time"s).AsInt();
         settings.bus_velocity = dict.at("bus_velocity"s).AsDouble();
+        if (const auto it = dict.find("walk_velocity"s); it != dict.end()) {
+            settings.walk_velocity = it->second.AsDouble();
+            if (!(settings.walk_velocity > 0)) {
+                throw RequestError("Invalid routing settings");
+            }
+        }
+        if (const auto it = dict.find("walk_distance"s); it != dict.end()) {
+            settings.walk_distance = it->second.AsDouble();
+            if (!(settings.walk_distance >= 0)) {
+                throw RequestError("Invalid routing settings");
+            }
+        }
     }
     catch (std::out_of_range const&) {
         throw RequestError("Invalid renderer settings");
@@ -165,24 +524,71 @@ routemap::RoutingSettings JsonReader::ParseRoutingSettings() const {
     return settings;
 }
 
-Document JsonReader::ProcessStatRequests() const {
-    const Array& stat_requests = GetNodeRequest("stat_requests"s).AsArray();
+JsonReader::JsonReader(catalog::TransportCatalogue& db, std::istream& in, size_t thread_count)
+    : data_(Node{})
+    , handler_(db, thread_count) {
+    LoadData(in);
+}
 
-    std::vector<StatRequest> requests;
-    for (const auto& request : stat_requests) {
-        requests.push_back(ParseStatRequest(request.AsDict()));
+BatchStats JsonReader::PrintStatRequest(std::ostream& out) const {
+    if (!stat_requests_) {
+        throw RequestError();
     }
-    return Document(handler_.ProcessStatQuery(requests, ParseRenderSettings(), ParseRoutingSettings()));
+    ViewStream input(*stat_requests_);
+    Reader reader(input);
+    StatRequestParser parser(reader);
+    return PrintStatRequests(std::ref(parser), out);
 }
 
-JsonReader::JsonReader(catalog::TransportCatalogue& db, std::istream& in)
-    : data_(json::Load(in))
-    , handler_(db) {
-    LoadData();
+BatchStats JsonReader::ProcessStatBatch(std::istream& in, std::ostream& out,
+                                        const std::function<void()>& interrupt) const {
+    // Запросы разбираются прямо из потока, пока выполняются уже прочитанные
+    Reader reader(in);
+    std::optional<BatchStats> stats;
+    try {
+        reader.BeginDict();
+        while (reader.Next()) {
+            if (reader.ReadKey() == "stat_requests"sv && !stats) {
+                StatRequestParser parser(reader);
+                stats = PrintStatRequests(std::ref(parser), out, interrupt);
+                if (parser.IsBroken()) {
+                    throw BrokenBatchError("Invalid stat_requests"s);
+                }
+            }
+            else {
+                reader.Skip();
+            }
+        }
+    }
+    catch (const ParsingError& e) {
+        if (!stats) {
+            throw;
+        }
+        // Ответ на пакет уже выведен, и второго ответа на него быть не должно
+        throw BrokenBatchError(e.what());
+    }
+    if (!stats) {
+        throw RequestError();
+    }
+    return *stats;
 }
 
-void JsonReader::PrintStatRequest(std::ostream& out) const {
-    Print(ProcessStatRequests(), out);
+BatchStats JsonReader::PrintStatRequests(const StatSource& source, std::ostream& out,
+                                         const std::function<void()>& interrupt) const {
+    renderer::RenderSettings render_settings = ParseRenderSettings();
+    routemap::RoutingSettings routing_settings = ParseRoutingSettings();
+    Writer writer(out);
+    BatchStats stats;
+    try {
+        stats = handler_.ProcessStatQuery(source, std::move(render_settings), routing_settings, writer, interrupt);
+    }
+    catch (const std::exception& e) {
+        // ProcessStatQuery закрыл массив ответом с ошибкой
+        writer.Finish();
+        throw BrokenBatchError(e.what());
+    }
+    writer.Finish();
+    return stats;
 }
 
 } // namespace json_reader
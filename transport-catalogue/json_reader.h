@@ -2,7 +2,10 @@
 #include "json.h"
 #include "request_handler.h"
 
-#include <algorithm>
+#include <functional>
+#include <memory_resource>
+#include <optional>
+#include <string>
 
 namespace json_reader {
 
@@ -12,41 +15,45 @@ public:
     RequestError() : runtime_error("Invalid request") {}
 };
 
-class JsonReader {
+// Пакет, массив ответов на который уже выведен и закрыт ответом с ошибкой,
+// но дочитать пакет нельзя: граница следующего пакета в потоке неизвестна
+class BrokenBatchError : public std::runtime_error {
 public:
-    JsonReader(catalog::TransportCatalogue& db, std::istream& in);
+    using runtime_error::runtime_error;
+};
 
-    void PrintStatRequest(std::ostream& out) const;
+class JsonReader {
+public:
+    JsonReader(catalog::TransportCatalogue& db, std::istream& in,
+               size_t thread_count = parallel::GetThreadCount());
+
+    // Записывает в out массив ответов на stat_requests загруженного документа.
+    // На запрос, который не удалось разобрать, отвечает ошибкой; после синтаксической ошибки,
+    // за которой запросы уже не прочитать, массив закрывается ответом с этой ошибкой
+    handler::BatchStats PrintStatRequest(std::ostream& out) const;
+    // Читает из in документ с разделом stat_requests и записывает в out массив ответов.
+    // Настройки берутся из загруженного документа. Можно вызывать из нескольких потоков.
+    // Ошибки в запросах обрабатываются так же, как в PrintStatRequest; если после выведенного
+    // массива документ нельзя дочитать, выбрасывается BrokenBatchError.
+    // interrupt прерывает ожидание данных из in, если выполнение запросов остановлено ошибкой
+    handler::BatchStats ProcessStatBatch(std::istream& in, std::ostream& out,
+                                         const std::function<void()>& interrupt = {}) const;
 
 private:
+    // арена для узлов data_: освобождается целиком вместе с JsonReader.
+    // Пакеты stat-запросов разбираются потоково, без дерева узлов, поэтому своя арена им не нужна
+    std::pmr::monotonic_buffer_resource arena_;
     json::Document data_;
+    // текст раздела stat_requests
+    std::optional<std::string> stat_requests_;
     handler::RequestHandler handler_;
 
-    void LoadData() const;
+    void LoadData(std::istream& in);
     const json::Node& GetNodeRequest(const std::string& name) const;
-    json::Document ProcessStatRequests() const;
+    handler::BatchStats PrintStatRequests(const handler::StatSource& source, std::ostream& out,
+                                          const std::function<void()>& interrupt = {}) const;
     renderer::RenderSettings ParseRenderSettings() const;
     routemap::RoutingSettings ParseRoutingSettings() const;
 };
 
-template <typename ReturnType, typename Iterator, typename Lambda>
-auto ConvertTo(Iterator first, Iterator last, Lambda lambda) {
-    ReturnType result{};
-    std::transform(first, last, std::inserter(result, end(result)), lambda);
-    return result;
-}
-
-template<typename Func>
-auto TryCatch(Func func, const json::Dict& dict) {
-    try {
-        return func(dict);
-    }
-    catch (std::out_of_range const&) {
-        throw RequestError();
-    }
-    catch (...) {
-        throw;
-    }
-}
-
 } // namespace json_reader
@@ -0,0 +1,281 @@
+#include "format.h"
+#include "json_writer.h"
+
+#include <algorithm>
+
+namespace json {
+
+using namespace std::literals;
+
+namespace detail {
+
+// Размер буфера, при превышении которого данные сбрасываются в поток
+constexpr size_t FLUSH_SIZE = 64 * 1024;
+constexpr int INDENT_STEP = 4;
+
+void AppendIndent(std::string& out, size_t depth) {
+    out.append(depth * INDENT_STEP, ' ');
+}
+
+} // namespace detail
+
+using namespace detail;
+
+void AppendEscaped(std::string& out, std::string_view str) {
+    json::detail::ForEachEscapedPart(str, [&out](std::string_view part) {
+        out += part;
+    });
+}
+
+void AppendString(std::string& out, std::string_view str) {
+    out.push_back('"');
+    AppendEscaped(out, str);
+    out.push_back('"');
+}
+
+Writer::Writer(std::ostream& out)
+    : out_(&out)
+    , precision_(static_cast<int>(out.precision())) {
+}
+
+Writer::Writer(size_t base_depth, int precision)
+    : precision_(precision)
+    , base_depth_(base_depth) {
+}
+
+Writer Writer::Nested() const {
+    return Writer(base_depth_ + depth_, precision_);
+}
+
+Writer::Frame& Writer::GetBackFrame() {
+    if (depth_ == 0) {
+        throw BuildError("No container is open"s);
+    }
+    return frames_[depth_ - 1];
+}
+
+std::string& Writer::GetTarget() {
+    // Содержимое открытого словаря копится в значении его последнего ключа
+    for (size_t i = depth_; i > 0; --i) {
+        Frame& frame = frames_[i - 1];
+        if (frame.is_dict) {
+            return frame.entries[frame.size - 1].value;
+        }
+    }
+    return buffer_;
+}
+
+void Writer::Emit(std::string_view str) {
+    std::string& target = GetTarget();
+    if (out_ && &target == &buffer_ && str.size() >= FLUSH_SIZE) {
+        // Большие значения пишем в поток напрямую, минуя буфер
+        FlushBuffer();
+        out_->write(str.data(), str.size());
+        return;
+    }
+    target += str;
+}
+
+void Writer::FlushBuffer() {
+    if (!out_) {
+        return;
+    }
+    out_->write(buffer_.data(), buffer_.size());
+    buffer_.clear();
+}
+
+std::string& Writer::BeginValue() {
+    if (is_finalized_) {
+        throw BuildError("Attempt to change finalized JSON"s);
+    }
+    if (depth_ == 0) {
+        return buffer_;
+    }
+
+    Frame& frame = frames_[depth_ - 1];
+    if (frame.is_dict) {
+        if (!is_value_expected_) {
+            throw BuildError("Key() was expected"s);
+        }
+        is_value_expected_ = false;
+        return frame.entries[frame.size - 1].value;
+    }
+
+    std::string& target = GetTarget();
+    target += frame.is_empty ? "\n"sv : ",\n"sv;
+    AppendIndent(target, base_depth_ + depth_);
+    frame.is_empty = false;
+    return target;
+}
+
+void Writer::EndValue() {
+    if (depth_ == 0) {
+        is_finalized_ = true;
+    }
+    if (buffer_.size() >= FLUSH_SIZE) {
+        FlushBuffer();
+    }
+}
+
+void Writer::PushFrame(bool is_dict) {
+    if (frames_.size() == depth_) {
+        frames_.emplace_back();
+    }
+    Frame& frame = frames_[depth_++];
+    frame.is_dict = is_dict;
+    frame.is_empty = true;
+    frame.size = 0;
+}
+
+void Writer::RenderDict(Frame& frame) {
+    const auto first = frame.entries.begin();
+    const auto last = first + frame.size;
+    const auto by_key = [](const Entry& lhs, const Entry& rhs) { return lhs.key < rhs.key; };
+    if (!std::is_sorted(first, last, by_key)) {
+        std::stable_sort(first, last, by_key);
+    }
+
+    std::string& target = GetTarget();
+    target.push_back('{');
+    if (first != last) {
+        target.push_back('\n');
+        const size_t max_size = std::max_element(first, last,
+            [](const Entry& lhs, const Entry& rhs) { return lhs.key.size() < rhs.key.size(); })->key.size();
+        std::string_view sep;
+
+        for (auto it = first; it != last; ++it) {
+            target += sep, sep = ",\n"sv;
+            AppendIndent(target, base_depth_ + depth_ + 1);
+            AppendString(target, it->key);
+            target.append(max_size - it->key.size(), ' ');
+            target += ": "sv;
+            Emit(it->raw_value.empty() ? std::string_view(it->value) : it->raw_value);
+        }
+        target.push_back('\n');
+        AppendIndent(target, base_depth_ + depth_);
+    }
+    target.push_back('}');
+}
+
+Writer::BaseContext Writer::Value(std::nullptr_t) {
+    BeginValue() += "null"sv;
+    EndValue();
+    return *this;
+}
+
+Writer::BaseContext Writer::Value(bool value) {
+    BeginValue() += value ? "true"sv : "false"sv;
+    EndValue();
+    return *this;
+}
+
+Writer::BaseContext Writer::Value(int value) {
+    format::AppendNumber(BeginValue(), value);
+    EndValue();
+    return *this;
+}
+
+Writer::BaseContext Writer::Value(double value) {
+    format::AppendNumber(BeginValue(), value, precision_);
+    EndValue();
+    return *this;
+}
+
+Writer::BaseContext Writer::Value(std::string_view value) {
+    AppendString(BeginValue(), value);
+    EndValue();
+    return *this;
+}
+
+Writer::BaseContext Writer::Value(const char* value) {
+    return Value(std::string_view{ value });
+}
+
+Writer::BaseContext Writer::RawValue(std::string_view json) {
+    if (depth_ > 0 && frames_[depth_ - 1].is_dict) {
+        Frame& frame = frames_[depth_ - 1];
+        BeginValue();
+        frame.entries[frame.size - 1].raw_value = json;
+    }
+    else {
+        BeginValue();
+        Emit(json);
+    }
+    EndValue();
+    return *this;
+}
+
+Writer::ArrayContext Writer::StartArray() {
+    BeginValue().push_back('[');
+    PushFrame(false);
+    return ArrayContext{ *this };
+}
+
+Writer::BaseContext Writer::EndArray() {
+    Frame& frame = GetBackFrame();
+    if (frame.is_dict) {
+        throw BuildError("EndArray() outside an array"s);
+    }
+    --depth_;
+
+    std::string& target = GetTarget();
+    if (!frame.is_empty) {
+        target.push_back('\n');
+        AppendIndent(target, base_depth_ + depth_);
+    }
+    target.push_back(']');
+    EndValue();
+    return *this;
+}
+
+Writer::DictKeyContext Writer::StartDict() {
+    BeginValue();
+    PushFrame(true);
+    return DictKeyContext{ *this };
+}
+
+Writer::BaseContext Writer::EndDict() {
+    Frame& frame = GetBackFrame();
+    if (!frame.is_dict || is_value_expected_) {
+        throw BuildError("EndDict() outside a dict"s);
+    }
+    --depth_;
+
+    RenderDict(frame);
+    EndValue();
+    return *this;
+}
+
+Writer::DictValueContext Writer::Key(std::string_view key) {
+    if (depth_ == 0 || !frames_[depth_ - 1].is_dict || is_value_expected_) {
+        throw BuildError("Key() outside a dict"s);
+    }
+
+    Frame& frame = frames_[depth_ - 1];
+    if (frame.size == frame.entries.size()) {
+        frame.entries.emplace_back();
+    }
+    Entry& entry = frame.entries[frame.size++];
+    entry.key.assign(key);
+    entry.value.clear();
+    entry.raw_value = {};
+    is_value_expected_ = true;
+    return DictValueContext{ *this };
+}
+
+void Writer::Finish() {
+    if (!is_finalized_) {
+        throw BuildError("Attempt to finish JSON which isn't finalized"s);
+    }
+    FlushBuffer();
+}
+
+std::string Writer::TakeString() {
+    if (!is_finalized_) {
+        throw BuildError("Attempt to take JSON which isn't finalized"s);
+    }
+    is_finalized_ = false;
+    return std::exchange(buffer_, {});
+}
+
+} // namespace json
@@ -0,0 +1,203 @@
+#pragma once
+#include "format.h"
+#include "json_builder.h"
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace json {
+
+// Дописывает в out строковый литерал JSON в том виде, в каком его выводят Writer и Print
+void AppendString(std::string& out, std::string_view str);
+// Дописывает в out содержимое строкового литерала JSON без кавычек
+void AppendEscaped(std::string& out, std::string_view str);
+
+// Дописывает в out строковый литерал JSON с текстом, который write(std::ostream&) выводит в поток.
+// Текст экранируется по мере вывода и отдельной строкой не сохраняется
+template <typename Write>
+void AppendStreamedString(std::string& out, Write write) {
+    out.push_back('"');
+    format::StringStream stream(out, [](std::string& target, std::string_view data) {
+        AppendEscaped(target, data);
+    });
+    write(static_cast<std::ostream&>(stream));
+    stream.Flush();
+    out.push_back('"');
+}
+
+/*
+ * Потоковый аналог Builder: вместо построения дерева Node сразу сериализует JSON
+ * в поток вывода в том же формате, что и json::Print.
+ * Ключи словаря, как и в Dict, выводятся отсортированными и выровненными,
+ * поэтому буферизуется только содержимое открытых словарей
+ */
+class Writer {
+private:
+    class ArrayContext;
+    class BaseContext;
+    class DictKeyContext;
+    class DictValueContext;
+
+public:
+    explicit Writer(std::ostream& out);
+
+    // Создаёт писатель, который сериализует в свой буфер значение для вставки
+    // в текущую позицию этого писателя (см. TakeString и RawValue).
+    // Так значения можно сериализовать в разных потоках, а выводить по порядку
+    Writer Nested() const;
+
+    ArrayContext StartArray();
+    BaseContext EndArray();
+    BaseContext EndDict();
+    BaseContext Value(std::nullptr_t);
+    BaseContext Value(bool value);
+    BaseContext Value(int value);
+    BaseContext Value(double value);
+    BaseContext Value(std::string_view value);
+    BaseContext Value(const char* value);
+    // Вставляет уже сериализованное значение (например, писателем из Nested()).
+    // Значение словаря не копируется, поэтому json должен существовать до закрытия словаря
+    BaseContext RawValue(std::string_view json);
+    DictKeyContext StartDict();
+    DictValueContext Key(std::string_view key);
+
+    // Проверяет, что JSON завершён, и сбрасывает остаток буфера в поток
+    void Finish();
+    // Для писателя из Nested(): возвращает сериализованное значение
+    // и подготавливает писатель к записи следующего
+    std::string TakeString();
+
+private:
+    struct Entry {
+        std::string key;
+        std::string value;
+        // значение, вставленное через RawValue без копирования
+        std::string_view raw_value;
+    };
+
+    struct Frame {
+        bool is_dict = false;
+        bool is_empty = true;
+        // число занятых элементов entries: сами строки переиспользуются между словарями
+        size_t size = 0;
+        std::vector<Entry> entries;
+    };
+
+    Writer(size_t base_depth, int precision);
+
+    // nullptr у писателя из Nested(): всё остаётся в buffer_
+    std::ostream* out_ = nullptr;
+    int precision_;
+    // уровень вложенности, на котором окажется записываемое значение
+    size_t base_depth_ = 0;
+    std::string buffer_;
+    // кадры открытых контейнеров; depth_ первых из них активны
+    std::vector<Frame> frames_;
+    size_t depth_ = 0;
+    bool is_value_expected_ = false;
+    bool is_finalized_ = false;
+
+    std::string& BeginValue();
+    void EndValue();
+    void PushFrame(bool is_dict);
+    Frame& GetBackFrame();
+    std::string& GetTarget();
+    void Emit(std::string_view str);
+    void FlushBuffer();
+    void RenderDict(Frame& frame);
+
+    class BaseContext {
+    private:
+        Writer& writer_;
+
+    public:
+        BaseContext(Writer& writer) : writer_(writer) {}
+
+        template <typename T>
+        BaseContext Value(T&& value) {
+            return writer_.Value(std::forward<T>(value));
+        }
+
+        BaseContext RawValue(std::string_view json) {
+            return writer_.RawValue(json);
+        }
+
+        BaseContext EndArray() {
+            return writer_.EndArray();
+        }
+        BaseContext EndDict() {
+            return writer_.EndDict();
+        }
+
+        ArrayContext StartArray() {
+            return writer_.StartArray();
+        }
+
+        DictKeyContext StartDict() {
+            return writer_.StartDict();
+        }
+
+        DictValueContext Key(std::string_view key) {
+            return writer_.Key(key);
+        }
+
+        void Finish() {
+            writer_.Finish();
+        }
+    };
+
+    class ArrayContext : public BaseContext {
+    public:
+        ArrayContext(BaseContext base) : BaseContext(base) {}
+
+        template <typename T>
+        ArrayContext Value(T&& value) {
+            return Writer::BaseContext::Value(std::forward<T>(value));
+        }
+
+        ArrayContext RawValue(std::string_view json) {
+            return Writer::BaseContext::RawValue(json);
+        }
+
+        BaseContext EndDict() = delete;
+        DictValueContext Key(std::string_view) = delete;
+        void Finish() = delete;
+    };
+
+    class DictValueContext : public BaseContext {
+    public:
+        DictValueContext(BaseContext base) : BaseContext(base) {}
+
+        template <typename T>
+        DictKeyContext Value(T&& value) {
+            return Writer::BaseContext::Value(std::forward<T>(value));
+        }
+
+        DictKeyContext RawValue(std::string_view json) {
+            return Writer::BaseContext::RawValue(json);
+        }
+
+        BaseContext EndArray() = delete;
+        BaseContext EndDict() = delete;
+        DictValueContext Key(std::string_view) = delete;
+        void Finish() = delete;
+    };
+
+    class DictKeyContext : public BaseContext {
+    public:
+        DictKeyContext(BaseContext base) : BaseContext(base) {}
+        ArrayContext StartArray() = delete;
+        BaseContext EndArray() = delete;
+        template <typename T>
+        BaseContext Value(T&&) = delete;
+        BaseContext RawValue(std::string_view) = delete;
+        DictKeyContext StartDict() = delete;
+        void Finish() = delete;
+    };
+};
+
+} // namespace json
@@ -1,11 +1,157 @@
 #include "json_reader.h"
+#include "metrics.h"
+#include "server.h"
 
+#include <charconv>
+#include <csignal>
 #include <iostream>
+#include <optional>
+#include <string_view>
+#include <thread>
 
 using namespace std;
 
-int main() {
+namespace {
+
+void PrintBuildTime(string_view name, const optional<handler::BatchStats::Duration>& time) {
+    cerr << name << ": "sv;
+    if (time) {
+        cerr << time->count() << " s\n"sv;
+    }
+    else {
+        cerr << "not built\n"sv;
+    }
+}
+
+// Выводит пропускную способность, занятость стадий конвейера (долю времени пакета,
+// которую потоки стадии были заняты работой, а не ожиданием очередей) и задержки полос
+void PrintStats(const handler::BatchStats& stats) {
+    PrintBuildTime("renderer"sv, stats.renderer);
+    PrintBuildTime("router"sv, stats.router);
+
+    const double total = stats.total.count();
+    cerr << "requests: "sv << stats.request_count << " in "sv << total << " s"sv;
+    if (total > 0) {
+        cerr << " ("sv << stats.request_count / total << " requests/s)"sv;
+    }
+    cerr << '\n';
+    for (const auto& stage : stats.stages) {
+        cerr << "stage "sv << stage.name << ": "sv << stage.busy.count() << " s busy"sv;
+        if (total > 0) {
+            cerr << ", occupancy "sv << 100 * stage.busy.count() / (total * stage.thread_count) << '%';
+        }
+        cerr << '\n';
+    }
+    for (const auto& lane : stats.lanes) {
+        cerr << "lane "sv << lane.name << ": "sv << lane.request_count << " requests"sv;
+        if (lane.request_count > 0) {
+            cerr << ", latency p50 "sv << lane.p50.count() << " s, p99 "sv << lane.p99.count()
+                 << " s, max "sv << lane.max.count() << " s"sv;
+        }
+        cerr << '\n';
+    }
+}
+
+// Разбирает число потоков из аргумента --threads=N; nullopt, если это не положительное число
+optional<size_t> ParseThreadCount(string_view value) {
+    size_t result = 0;
+    const auto [end, error] = from_chars(value.data(), value.data() + value.size(), result);
+    if (error != errc{} || end != value.data() + value.size() || result == 0) {
+        return nullopt;
+    }
+    return result;
+}
+
+// Блокирует SIGINT и SIGTERM в вызывающем потоке и потоках, которые он создаст позже.
+// Возвращает заблокированные сигналы
+sigset_t BlockStopSignals() {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    return signals;
+}
+
+// Обслуживает запросы на сокете, пока процесс не получит один из сигналов signals.
+// Сигналы должны быть заблокированы (BlockStopSignals) во всех потоках процесса:
+// их принимает отдельный поток
+void Serve(const json_reader::JsonReader& reader, const string& socket_path, sigset_t signals) {
+    server::Server server(reader, socket_path);
+    thread stopper([&server, signals] {
+        int signal;
+        sigwait(&signals, &signal);
+        server.Stop();
+    });
+    // Поток сигналов обращается к server, поэтому дожидаемся его. Если сервер завершился
+    // не по сигналу, поток будится сигналом, который ждёт только он
+    const auto join_stopper = [&stopper] {
+        pthread_kill(stopper.native_handle(), SIGTERM);
+        stopper.join();
+    };
+    try {
+        server.Run();
+    }
+    catch (...) {
+        join_stopper();
+        throw;
+    }
+    join_stopper();
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    // Число рабочих потоков можно задать аргументом --threads=N,
+    // а --timings выводит в stderr время создания рендерера и маршрутизатора и статистику пакета.
+    // С --serve=PATH после загрузки базы stat-запросы принимаются на Unix domain socket PATH.
+    // --stats выводит в stderr накопленные метрики (как ответ на запрос Stats) перед выходом
+    size_t thread_count = parallel::GetThreadCount();
+    bool print_timings = false;
+    bool print_metrics = false;
+    string socket_path;
+    const string_view threads_arg = "--threads="sv;
+    const string_view serve_arg = "--serve="sv;
+    for (int i = 1; i < argc; ++i) {
+        const string_view arg = argv[i];
+        if (arg.substr(0, threads_arg.size()) == threads_arg) {
+            const auto count = ParseThreadCount(arg.substr(threads_arg.size()));
+            if (!count) {
+                cerr << "usage: "sv << argv[0] << " [--threads=N] [--serve=PATH] [--timings] [--stats]\n"sv
+                     << "invalid thread count: "sv << arg << '\n';
+                return 1;
+            }
+            thread_count = *count;
+        }
+        else if (arg.substr(0, serve_arg.size()) == serve_arg) {
+            socket_path = string(arg.substr(serve_arg.size()));
+        }
+        else if (arg == "--timings"sv) {
+            print_timings = true;
+        }
+        else if (arg == "--stats"sv) {
+            print_metrics = true;
+        }
+    }
+
+    // Сигналы блокируются до создания первых потоков (пула обработчика запросов)
+    optional<sigset_t> stop_signals;
+    if (!socket_path.empty()) {
+        stop_signals = BlockStopSignals();
+    }
     catalog::TransportCatalogue catalogue;
-    json_reader::JsonReader reader(catalogue, std::cin);
-    reader.PrintStatRequest(std::cout);
-}
\ No newline at end of file
+    json_reader::JsonReader reader(catalogue, std::cin, thread_count);
+    if (stop_signals) {
+        Serve(reader, socket_path, *stop_signals);
+    }
+    else {
+        const auto stats = reader.PrintStatRequest(std::cout);
+        if (print_timings) {
+            PrintStats(stats);
+        }
+    }
+
+    if (print_metrics) {
+        metrics::PrintStats(cerr);
+    }
+}
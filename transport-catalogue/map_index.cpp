@@ -0,0 +1,154 @@
+#include "map_index.h"
+#include "map_renderer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iterator>
+
+namespace renderer {
+
+using namespace catalog;
+
+namespace detail {
+
+// Среднее число остановок в ячейке сетки
+constexpr size_t STOPS_PER_CELL = 4;
+// Наибольшее число столбцов и строк сетки
+constexpr size_t MAX_GRID_SIDE = 1024;
+
+} // namespace detail
+
+MapIndex::MapIndex(const std::set<const Bus*>& routes)
+    : routes_(routes.begin(), routes.end()) {
+    std::set<const Stop*> stops;
+    for (const Bus* bus : routes_) {
+        stops.insert(bus->stops.begin(), bus->stops.end());
+    }
+    if (stops.empty()) {
+        cells_.resize(1);
+        return;
+    }
+
+    GeoBounds bounds{ (*stops.begin())->coordinate, (*stops.begin())->coordinate };
+    for (const Stop* stop : stops) {
+        bounds.Extend(stop->coordinate);
+    }
+    bounds_ = bounds;
+
+    const auto side = static_cast<size_t>(std::ceil(std::sqrt(stops.size() / double(detail::STOPS_PER_CELL))));
+    columns_ = rows_ = std::clamp<size_t>(side, 1, detail::MAX_GRID_SIDE);
+    // У вырожденной области (все остановки на одной широте или долготе) ячейка единичная
+    const double width = bounds.max.lng - bounds.min.lng;
+    const double height = bounds.max.lat - bounds.min.lat;
+    cell_width_ = width > 0 ? width / columns_ : 1.0;
+    cell_height_ = height > 0 ? height / rows_ : 1.0;
+    cells_.resize(columns_ * rows_);
+
+    for (const Stop* stop : stops) {
+        GetCell(GetRow(stop->coordinate.lat), GetColumn(stop->coordinate.lng)).stops.push_back(stop);
+    }
+    // Обратный путь некольцевого маршрута проходит по тем же отрезкам
+    for (uint32_t route = 0; route < routes_.size(); ++route) {
+        const auto& route_stops = routes_[route]->stops;
+        for (size_t i = 1; i < route_stops.size(); ++i) {
+            ForEachCell(route_stops[i - 1]->coordinate, route_stops[i]->coordinate, [this, route](Cell& cell) {
+                if (cell.routes.empty() || cell.routes.back() != route) {
+                    cell.routes.push_back(route);
+                }
+            });
+        }
+    }
+}
+
+const std::optional<GeoBounds>& MapIndex::GetBounds() const {
+    return bounds_;
+}
+
+std::optional<GeoBounds> MapIndex::GetTileBounds(Tile tile) const {
+    if (!bounds_) {
+        return std::nullopt;
+    }
+    const double count = std::ldexp(1.0, tile.z);
+    const double width = (bounds_->max.lng - bounds_->min.lng) / count;
+    const double height = (bounds_->max.lat - bounds_->min.lat) / count;
+    // SphereProjector не может растянуть такой тайл на изображение
+    if (tile.z > 0 && IsZero(width) && IsZero(height)) {
+        return std::nullopt;
+    }
+    const double west = bounds_->min.lng + tile.x * width;
+    const double north = bounds_->max.lat - tile.y * height;
+    return GeoBounds{ { north - height, west }, { north, west + width } };
+}
+
+MapIndex::Area MapIndex::Find(const GeoBounds& bounds, double margin) const {
+    Area result;
+    const GeoBounds around{ { bounds.min.lat - margin, bounds.min.lng - margin },
+                            { bounds.max.lat + margin, bounds.max.lng + margin } };
+    if (!bounds_ || around.max.lat < bounds_->min.lat || around.min.lat > bounds_->max.lat
+        || around.max.lng < bounds_->min.lng || around.min.lng > bounds_->max.lng) {
+        return result;
+    }
+
+    // Остановки из ячеек вокруг области отбрасываются проверкой на попадание в неё
+    std::vector<uint32_t> routes;
+    for (size_t row = GetRow(around.min.lat), last_row = GetRow(around.max.lat); row <= last_row; ++row) {
+        for (size_t column = GetColumn(around.min.lng), last_column = GetColumn(around.max.lng);
+             column <= last_column; ++column) {
+            const Cell& cell = cells_[row * columns_ + column];
+            routes.insert(routes.end(), cell.routes.begin(), cell.routes.end());
+            std::copy_if(cell.stops.begin(), cell.stops.end(), std::back_inserter(result.stops),
+                [&bounds](const Stop* stop) { return bounds.Contains(stop->coordinate); });
+        }
+    }
+
+    std::sort(routes.begin(), routes.end());
+    routes.erase(std::unique(routes.begin(), routes.end()), routes.end());
+    result.routes.reserve(routes.size());
+    for (const uint32_t route : routes) {
+        result.routes.push_back({ routes_[route], route });
+    }
+    std::sort(result.stops.begin(), result.stops.end(), std::less<const Stop*>());
+    return result;
+}
+
+size_t MapIndex::GetColumn(double lng) const {
+    const double column = std::floor((lng - bounds_->min.lng) / cell_width_);
+    return static_cast<size_t>(std::clamp(column, 0.0, double(columns_ - 1)));
+}
+
+size_t MapIndex::GetRow(double lat) const {
+    const double row = std::floor((lat - bounds_->min.lat) / cell_height_);
+    return static_cast<size_t>(std::clamp(row, 0.0, double(rows_ - 1)));
+}
+
+MapIndex::Cell& MapIndex::GetCell(size_t row, size_t column) {
+    return cells_[row * columns_ + column];
+}
+
+template <typename Action>
+void MapIndex::ForEachCell(geo::Coordinates from, geo::Coordinates to, Action action) {
+    if (from.lng > to.lng) {
+        std::swap(from, to);
+    }
+    // Отрезок обходится по столбцам: в каждом столбце он занимает ячейки
+    // между широтами своих точек на границах столбца
+    const auto get_lat = [&from, &to](double lng) {
+        return to.lng > from.lng ? from.lat + (to.lat - from.lat) * (lng - from.lng) / (to.lng - from.lng) : from.lat;
+    };
+    const size_t first_column = GetColumn(from.lng);
+    const size_t last_column = GetColumn(to.lng);
+    double west_lat = from.lat;
+    for (size_t column = first_column; column <= last_column; ++column) {
+        const double east_lat = column == last_column
+            ? to.lat
+            : get_lat(bounds_->min.lng + (column + 1) * cell_width_);
+        const size_t last_row = GetRow(std::max(west_lat, east_lat));
+        for (size_t row = GetRow(std::min(west_lat, east_lat)); row <= last_row; ++row) {
+            action(GetCell(row, column));
+        }
+        west_lat = east_lat;
+    }
+}
+
+} // namespace renderer
@@ -0,0 +1,83 @@
+#pragma once
+#include "domain.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <set>
+#include <vector>
+
+namespace renderer {
+
+// прямоугольная область в географических координатах
+using GeoBounds = geo::Bounds;
+
+// Тайл z/x/y: область всех остановок карты делится на 2^z × 2^z тайлов,
+// x отсчитывается с запада, y — с севера
+struct Tile {
+    int z = 0;
+    int x = 0;
+    int y = 0;
+};
+
+// Наибольший масштаб тайла
+inline constexpr int MAX_TILE_ZOOM = 30;
+
+// маршрут и номер его цвета в палитре
+struct ColoredRoute {
+    const catalog::Bus* bus = nullptr;
+    size_t color = 0;
+};
+
+/*
+ * Пространственный индекс карты: равномерная сетка над областью остановок маршрутов.
+ * В ячейке хранятся её остановки и маршруты, отрезки которых проходят через ячейку,
+ * поэтому выборка области обходит только её ячейки
+ */
+class MapIndex {
+public:
+    // содержимое карты в области
+    struct Area {
+        // маршруты в порядке названий с цветами, как на полной карте
+        std::vector<ColoredRoute> routes;
+        // остановки области в порядке названий
+        std::vector<const catalog::Stop*> stops;
+    };
+
+    explicit MapIndex(const std::set<const catalog::Bus*>& routes);
+
+    // Область всех остановок маршрутов; nullopt, если маршрутов нет
+    const std::optional<GeoBounds>& GetBounds() const;
+    // Границы тайла; nullopt, если маршрутов нет или тайл так мал, что его нельзя растянуть
+    // на изображение (обе стороны меньше EPSILON)
+    std::optional<GeoBounds> GetTileBounds(Tile tile) const;
+
+    // Маршруты, которые могут проходить через область или ближе margin градусов к ней, и остановки в области
+    Area Find(const GeoBounds& bounds, double margin = 0.0) const;
+
+private:
+    struct Cell {
+        std::vector<const catalog::Stop*> stops;
+        // номера маршрутов в routes_ по возрастанию
+        std::vector<uint32_t> routes;
+    };
+
+    // маршруты в порядке названий; номер маршрута определяет его цвет
+    std::vector<const catalog::Bus*> routes_;
+    std::optional<GeoBounds> bounds_;
+    size_t columns_ = 1;
+    size_t rows_ = 1;
+    double cell_width_ = 1.0;
+    double cell_height_ = 1.0;
+    // ячейки по строкам с юга на север
+    std::vector<Cell> cells_;
+
+    size_t GetColumn(double lng) const;
+    size_t GetRow(double lat) const;
+    Cell& GetCell(size_t row, size_t column);
+    // Вызывает action для каждой ячейки, через которую проходит отрезок [from, to]
+    template <typename Action>
+    void ForEachCell(geo::Coordinates from, geo::Coordinates to, Action action);
+};
+
+} // namespace renderer
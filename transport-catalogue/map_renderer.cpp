@@ -1,5 +1,13 @@
+#include "format.h"
 #include "map_renderer.h"
+#include "parallel.h"
 
+#include <cmath>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
 #include <utility>
 
 namespace renderer {
@@ -19,108 +27,464 @@ Text CreateUnderlay(Text text, const RenderSettings& settings) {
     return text;
 }
 
-std::vector<geo::Coordinates> GetCoordinatesOfBusStops(const std::set<const Bus*>& routes) {
-    return ExtractData<std::vector<geo::Coordinates>>(
-        routes, [](const Stop* stop) { return stop->coordinate; });
+// Классы компактной карты (см. RenderSettings::compact_svg)
+constexpr std::string_view ROUTE_CLASS = "r"sv;
+constexpr std::string_view STOP_CLASS = "p"sv;
+constexpr std::string_view BUS_LABEL_CLASS = "b"sv;
+constexpr std::string_view STOP_LABEL_CLASS = "s"sv;
+constexpr std::string_view UNDERLAY_CLASS = "u"sv;
+// к префиксам добавляется номер цвета палитры
+constexpr std::string_view STROKE_CLASS_PREFIX = "c"sv;
+constexpr std::string_view FILL_CLASS_PREFIX = "f"sv;
+
+template <typename... Values>
+std::string Concat(const Values&... values) {
+    std::ostringstream os;
+    (os << ... << values);
+    return os.str();
 }
 
-std::set<const Stop*> GetStopsFromRoutes(const std::set<const Bus*>& routes) {
-    return ExtractData<std::set<const catalog::Stop*>>(
+// Стиль компактной карты: у подложки цвет заливки тот же, что у обводки,
+// поэтому её правило идёт последним и перекрывает заливку подписи остановки
+Style MakeStyle(const RenderSettings& settings) {
+    Style style;
+    style.AddRule(std::string(ROUTE_CLASS), Concat(
+        "fill:none;stroke-width:"sv, settings.line_width,
+        ";stroke-linecap:round;stroke-linejoin:round"sv));
+    style.AddRule(std::string(STOP_CLASS), "fill:white"s);
+    style.AddRule(std::string(BUS_LABEL_CLASS), Concat(
+        "font-size:"sv, settings.bus_label_font_size, "px;font-family:Verdana;font-weight:bold"sv));
+    style.AddRule(std::string(STOP_LABEL_CLASS), Concat(
+        "font-size:"sv, settings.stop_label_font_size, "px;font-family:Verdana;fill:black"sv));
+    for (size_t i = 0; i < settings.color_palette.size(); ++i) {
+        style.AddRule(Concat(STROKE_CLASS_PREFIX, i), Concat("stroke:"sv, settings.color_palette[i]));
+    }
+    for (size_t i = 0; i < settings.color_palette.size(); ++i) {
+        style.AddRule(Concat(FILL_CLASS_PREFIX, i), Concat("fill:"sv, settings.color_palette[i]));
+    }
+    style.AddRule(std::string(UNDERLAY_CLASS), Concat(
+        "fill:"sv, settings.underlayer_color, ";stroke:"sv, settings.underlayer_color,
+        ";stroke-width:"sv, settings.underlayer_width, ";stroke-linecap:round;stroke-linejoin:round"sv));
+    return style;
+}
+
+std::vector<const Stop*> GetStopsFromRoutes(const std::set<const Bus*>& routes) {
+    const auto stops = ExtractData<std::set<const catalog::Stop*>>(
         routes, [](const Stop* stop) { return stop; });
+    return { stops.begin(), stops.end() };
+}
+
+SphereProjector MakeProjector(const std::optional<geo::Bounds>& bounds, const RenderSettings& settings) {
+    return { bounds, settings.width, settings.height, settings.padding };
+}
+
+// Маршруты с номерами цветов по порядку названий
+std::vector<ColoredRoute> ColorRoutes(const std::set<const Bus*>& routes) {
+    std::vector<ColoredRoute> result;
+    result.reserve(routes.size());
+    for (const Bus* route : routes) {
+        result.push_back({ route, result.size() });
+    }
+    return result;
+}
+
+// Наименьшее число объектов карты в части, выводимой отдельным потоком
+constexpr size_t MIN_CHUNK_SIZE = 1024;
+
+// Квадрат расстояния от точки до отрезка [from, to]
+double GetSquaredDistance(Point point, Point from, Point to) {
+    const double dx = to.x - from.x;
+    const double dy = to.y - from.y;
+    const double length = dx * dx + dy * dy;
+    double t = 0.0;
+    if (length > 0) {
+        t = std::clamp(((point.x - from.x) * dx + (point.y - from.y) * dy) / length, 0.0, 1.0);
+    }
+    const double x = point.x - from.x - t * dx;
+    const double y = point.y - from.y - t * dy;
+    return x * x + y * y;
+}
+
+// Упрощает ломаную алгоритмом Дугласа — Пекера: оставляет вершины, без которых ломаная
+// отклонилась бы больше чем на tolerance. Первая и последняя вершины сохраняются
+std::vector<Point> Simplify(const std::vector<Point>& points, double tolerance) {
+    if (points.size() < 3) {
+        return points;
+    }
+
+    std::vector<bool> is_kept(points.size());
+    is_kept.front() = is_kept.back() = true;
+    const double squared_tolerance = tolerance * tolerance;
+    std::vector<std::pair<size_t, size_t>> ranges{ { 0, points.size() - 1 } };
+    while (!ranges.empty()) {
+        const auto [first, last] = ranges.back();
+        ranges.pop_back();
+
+        double max_distance = squared_tolerance;
+        size_t farthest = first;
+        for (size_t i = first + 1; i < last; ++i) {
+            const double distance = GetSquaredDistance(points[i], points[first], points[last]);
+            if (distance > max_distance) {
+                max_distance = distance;
+                farthest = i;
+            }
+        }
+        if (farthest != first) {
+            is_kept[farthest] = true;
+            ranges.push_back({ first, farthest });
+            ranges.push_back({ farthest, last });
+        }
+    }
+
+    std::vector<Point> result;
+    for (size_t i = 0; i < points.size(); ++i) {
+        if (is_kept[i]) {
+            result.push_back(points[i]);
+        }
+    }
+    return result;
 }
 
+// Прямоугольник на изображении
+struct Rect {
+    Point min;
+    Point max;
+};
+
+// Проходит ли отрезок [from, to] через прямоугольник rect (отсечение Лианга — Барски)
+bool Intersects(Point from, Point to, const Rect& rect) {
+    double t0 = 0.0;
+    double t1 = 1.0;
+    // Сужает [t0, t1] до части отрезка по внутреннюю сторону одной границы
+    const auto clip = [&t0, &t1](double p, double q) {
+        if (p == 0) {
+            return q >= 0;
+        }
+        const double t = q / p;
+        if (p < 0) {
+            t0 = std::max(t0, t);
+        }
+        else {
+            t1 = std::min(t1, t);
+        }
+        return t0 <= t1;
+    };
+    const double dx = to.x - from.x;
+    const double dy = to.y - from.y;
+    return clip(-dx, from.x - rect.min.x) && clip(dx, rect.max.x - from.x)
+        && clip(-dy, from.y - rect.min.y) && clip(dy, rect.max.y - from.y);
+}
+
+// Части ломаной из идущих подряд отрезков, которые проходят через rect
+std::vector<std::vector<Point>> ClipPolyline(const std::vector<Point>& points, const Rect& rect) {
+    std::vector<std::vector<Point>> parts;
+    if (points.size() == 1 && Intersects(points.front(), points.front(), rect)) {
+        parts.push_back(points);
+    }
+    bool is_continued = false;
+    for (size_t i = 1; i < points.size(); ++i) {
+        if (!Intersects(points[i - 1], points[i], rect)) {
+            is_continued = false;
+            continue;
+        }
+        if (!is_continued) {
+            parts.push_back({ points[i - 1] });
+            is_continued = true;
+        }
+        parts.back().push_back(points[i]);
+    }
+    return parts;
+}
+
+/*
+ * Точки уже выведенных подписей, разложенные по квадратным ячейкам со стороной tolerance:
+ * точки ближе tolerance к новой лежат в её ячейке или соседних
+ */
+class LabelGrid {
+public:
+    explicit LabelGrid(double tolerance)
+        : tolerance_(tolerance) {
+    }
+
+    // Занимает точку, если ближе tolerance нет занятых точек
+    bool TryPlace(Point point) {
+        const int64_t column = GetCell(point.x);
+        const int64_t row = GetCell(point.y);
+        for (int64_t i = row - 1; i <= row + 1; ++i) {
+            for (int64_t j = column - 1; j <= column + 1; ++j) {
+                const auto it = cells_.find(GetKey(i, j));
+                if (it == cells_.end()) {
+                    continue;
+                }
+                for (const Point other : it->second) {
+                    const double dx = other.x - point.x;
+                    const double dy = other.y - point.y;
+                    if (dx * dx + dy * dy < tolerance_ * tolerance_) {
+                        return false;
+                    }
+                }
+            }
+        }
+        cells_[GetKey(row, column)].push_back(point);
+        return true;
+    }
+
+private:
+    double tolerance_;
+    std::unordered_map<uint64_t, std::vector<Point>> cells_;
+
+    int64_t GetCell(double coordinate) const {
+        return static_cast<int64_t>(std::floor(coordinate / tolerance_));
+    }
+
+    static uint64_t GetKey(int64_t row, int64_t column) {
+        return (static_cast<uint64_t>(static_cast<uint32_t>(row)) << 32) | static_cast<uint32_t>(column);
+    }
+};
+
 } // namespace detail
 
+bool operator==(const RenderSettings& lhs, const RenderSettings& rhs) {
+    return lhs.width == rhs.width && lhs.height == rhs.height && lhs.padding == rhs.padding
+        && lhs.line_width == rhs.line_width && lhs.stop_radius == rhs.stop_radius
+        && lhs.bus_label_font_size == rhs.bus_label_font_size && lhs.stop_label_font_size == rhs.stop_label_font_size
+        && lhs.bus_label_offset == rhs.bus_label_offset && lhs.stop_label_offset == rhs.stop_label_offset
+        && lhs.underlayer_color == rhs.underlayer_color && lhs.underlayer_width == rhs.underlayer_width
+        && lhs.color_palette == rhs.color_palette && lhs.simplify_tolerance == rhs.simplify_tolerance
+        && lhs.compact_svg == rhs.compact_svg;
+}
+
 bool IsZero(double value) {
     return std::abs(value) < EPSILON;
 }
 
+
 using namespace detail;
 
-Document MapRenderer::RenderMap(const std::set<const Bus*>& routes) const {
-    using namespace detail;
+Document MapRenderer::RenderMap(const std::set<const Bus*>& routes, const std::optional<geo::Bounds>& bounds) const {
+    Document doc;
+    RenderMap(routes, bounds, doc);
+    return doc;
+}
 
-    const auto geo_coords = GetCoordinatesOfBusStops(routes);
-    const SphereProjector proj{
-        geo_coords.begin(), geo_coords.end(), settings_.width, settings_.height, settings_.padding
-    };
+void MapRenderer::RenderMap(const std::set<const Bus*>& routes, const std::optional<geo::Bounds>& bounds,
+                            ObjectContainer& doc) const {
+    const SphereProjector proj = MakeProjector(bounds, settings_);
+    const Layers layers = MakeLayers(ColorRoutes(routes), GetStopsFromRoutes(routes), proj);
+    if (settings_.compact_svg) {
+        doc.Add(MakeStyle(settings_));
+    }
+    RenderLayers(layers, 0, layers.GetSize(), proj, doc);
+}
 
-    Document doc;
-    RenderRoute(routes, proj, doc);
-    RenderRouteName(routes, proj, doc);
+void MapRenderer::RenderMap(const std::set<const Bus*>& routes, const std::optional<geo::Bounds>& bounds,
+                            std::ostream& out, size_t thread_count, const parallel::Spawn& spawn) const {
+    const SphereProjector proj = MakeProjector(bounds, settings_);
+    RenderLayers(MakeLayers(ColorRoutes(routes), GetStopsFromRoutes(routes), proj), proj, out, thread_count, spawn);
+}
 
-    const auto stops = GetStopsFromRoutes(routes);
-    RenderStop(stops, proj, doc);
-    RenderStopName(stops, proj, doc);
+void MapRenderer::RenderArea(const MapIndex& index, const GeoBounds& bounds, std::ostream& out,
+                             size_t thread_count, const parallel::Spawn& spawn) const {
+    const SphereProjector proj = MakeProjector(bounds, settings_);
 
-    return doc;
+    // Линия маршрута видна в области, даже если проходит рядом с ней ближе половины своей толщины
+    const double margin = proj.GetZoom() > 0 ? settings_.line_width / 2 / proj.GetZoom() : 0.0;
+    auto area = index.Find(bounds, margin);
+    Layers layers = MakeLayers(std::move(area.routes), std::move(area.stops), proj);
+    layers.area = bounds;
+    RenderLayers(layers, proj, out, thread_count, spawn);
 }
 
-void MapRenderer::RenderRoute(const std::set<const Bus*>& routes, const SphereProjector& proj, Document& doc) const {
-    int index_color = 0;
-    auto count_color = settings_.color_palette.size();
-    for (auto route : routes) {
-        auto shape = Polyline()
-            .SetStrokeColor(settings_.color_palette.at(index_color))
+MapRenderer::Layers MapRenderer::MakeLayers(std::vector<ColoredRoute> routes, std::vector<const Stop*> stops,
+                                            const SphereProjector& proj) const {
+    Layers layers;
+    layers.routes = std::move(routes);
+    if (settings_.simplify_tolerance > 0) {
+        // Прореживание зависит от уже выведенных подписей, поэтому выполняется до рисования
+        LabelGrid grid(settings_.simplify_tolerance);
+        std::copy_if(stops.begin(), stops.end(), std::back_inserter(layers.labels),
+            [&grid, &proj](const Stop* stop) { return grid.TryPlace(proj(stop->coordinate)); });
+    }
+    else {
+        layers.labels = stops;
+    }
+    layers.stops = std::move(stops);
+    return layers;
+}
+
+void MapRenderer::RenderLayers(const Layers& layers, size_t begin, size_t end,
+                               const SphereProjector& proj, ObjectContainer& doc) const {
+    // Вызывает render для элементов слоя, номера которых попадают в [begin, end)
+    size_t offset = 0;
+    const auto render_layer = [&](const auto& items, auto render) {
+        const size_t first = std::clamp(begin, offset, offset + items.size()) - offset;
+        const size_t last = std::clamp(end, offset, offset + items.size()) - offset;
+        for (size_t i = first; i < last; ++i) {
+            render(items[i]);
+        }
+        offset += items.size();
+    };
+    render_layer(layers.routes, [&](const ColoredRoute& route) { RenderRoute(route, proj, layers.area, doc); });
+    render_layer(layers.routes, [&](const ColoredRoute& route) { RenderRouteName(route, proj, layers.area, doc); });
+    render_layer(layers.stops, [&](const Stop* stop) { RenderStop(stop, proj, doc); });
+    render_layer(layers.labels, [&](const Stop* stop) { RenderStopName(stop, proj, doc); });
+}
+
+void MapRenderer::RenderLayers(const Layers& layers, const SphereProjector& proj, std::ostream& out,
+                               size_t thread_count, const parallel::Spawn& spawn) const {
+    StreamDocument doc(out);
+    if (settings_.compact_svg) {
+        doc.Add(MakeStyle(settings_));
+    }
+    if (thread_count <= 1) {
+        RenderLayers(layers, 0, layers.GetSize(), proj, doc);
+    }
+    else {
+        // Объекты делятся на непрерывные части, каждая выводится в свой буфер
+        const size_t size = layers.GetSize();
+        std::vector<std::string> parts(std::clamp<size_t>(size / MIN_CHUNK_SIZE, 1, thread_count));
+        parallel::ForEachChunk(parts.size(), 1, [&](size_t first_part, size_t last_part) {
+            for (size_t i = first_part; i < last_part; ++i) {
+                format::StringStream part(parts[i]);
+                StreamFragment fragment(part);
+                RenderLayers(layers, size * i / parts.size(), size * (i + 1) / parts.size(), proj, fragment);
+                part.Flush();
+            }
+        }, parts.size(), spawn);
+        for (const std::string& part : parts) {
+            doc.AddFragment(part);
+        }
+    }
+    doc.Finish();
+}
+
+void MapRenderer::RenderRoute(const ColoredRoute& colored_route, const SphereProjector& proj,
+                              const std::optional<GeoBounds>& area, ObjectContainer& doc) const {
+    const auto& [route, color] = colored_route;
+    const size_t color_index = color % settings_.color_palette.size();
+    Polyline shape;
+    if (settings_.compact_svg) {
+        shape.SetClass(Concat(ROUTE_CLASS, ' ', STROKE_CLASS_PREFIX, color_index));
+    }
+    else {
+        shape.SetStrokeColor(settings_.color_palette.at(color_index))
             .SetFillColor(NoneColor)
             .SetStrokeWidth(settings_.line_width)
             .SetStrokeLineCap(StrokeLineCap::ROUND)
             .SetStrokeLineJoin(StrokeLineJoin::ROUND);
+    }
 
-        auto& stops = route->stops;
+    auto& stops = route->stops;
+    if (area) {
+        // Обратный путь некольцевого маршрута проходит по тем же отрезкам, поэтому выводится только прямой.
+        // Отрезок за областью тоже выводится, если линия ближе половины своей толщины к ней (см. RenderArea)
+        std::vector<Point> points;
+        points.reserve(stops.size());
+        for (const Stop* stop : stops) {
+            points.push_back(proj(stop->coordinate));
+        }
+        if (settings_.simplify_tolerance > 0) {
+            points = Simplify(points, settings_.simplify_tolerance);
+        }
+        const double margin = settings_.line_width / 2;
+        const Point north_west = proj({ area->max.lat, area->min.lng });
+        const Point south_east = proj({ area->min.lat, area->max.lng });
+        const Rect rect{ { north_west.x - margin, north_west.y - margin },
+                         { south_east.x + margin, south_east.y + margin } };
+        for (const auto& part : ClipPolyline(points, rect)) {
+            Polyline part_shape = shape;
+            for (const Point point : part) {
+                part_shape.AddPoint(point);
+            }
+            doc.Add(std::move(part_shape));
+        }
+        return;
+    }
+    if (settings_.simplify_tolerance > 0) {
+        // Обратный путь некольцевого маршрута повторяет упрощённый прямой
+        std::vector<Point> points;
+        points.reserve(stops.size());
+        for (const Stop* stop : stops) {
+            points.push_back(proj(stop->coordinate));
+        }
+        points = Simplify(points, settings_.simplify_tolerance);
+        for (const Point point : points) {
+            shape.AddPoint(point);
+        }
+        if (!route->is_roundtrip) {
+            std::for_each(std::next(points.rbegin()), points.rend(), [&shape](Point point) {
+                shape.AddPoint(point);
+            });
+        }
+    }
+    else {
         AddRoutePoints(stops.begin(), stops.end(), shape, proj);
         if (!route->is_roundtrip) {
             AddRoutePoints(std::next(stops.rbegin()), stops.rend(), shape, proj);
         }
-
-        doc.AddPtr(std::make_unique<Polyline>(std::move(shape)));
-        ++index_color %= count_color;
     }
+
+    doc.Add(std::move(shape));
 }
 
-void MapRenderer::RenderRouteName(const std::set<const Bus*>& routes, const SphereProjector& proj, Document& doc) const {
-    int index_color = 0;
-    auto count_color = settings_.color_palette.size();
+void MapRenderer::RenderRouteName(const ColoredRoute& colored_route, const SphereProjector& proj,
+                                  const std::optional<GeoBounds>& area, ObjectContainer& doc) const {
+    const auto& [route, color] = colored_route;
+    const size_t color_index = color % settings_.color_palette.size();
+    const Stop* stop = route->stops.front();
+    const Stop* final_stop = route->stops.back();
+    do {
+        // Названия у остановок за областью не выводятся, как и сами остановки
+        if (area && !area->Contains(stop->coordinate)) {
+            continue;
+        }
+        auto text = Text()
+            .SetPosition(proj(stop->coordinate))
+            .SetOffset(settings_.bus_label_offset)
+            .SetData(route->name);
 
-    for (auto route : routes) {
-        const Stop* stop = route->stops.front();
-        const Stop* final_stop = route->stops.back();
-        do {
-            auto text = Text()
-                .SetPosition(proj(stop->coordinate))
-                .SetOffset(settings_.bus_label_offset)
-                .SetFontSize(settings_.bus_label_font_size)
+        if (settings_.compact_svg) {
+            text.SetFontSize(std::nullopt);
+            doc.Add(Text(text).SetClass(Concat(BUS_LABEL_CLASS, ' ', UNDERLAY_CLASS)));
+            doc.Add(text.SetClass(Concat(BUS_LABEL_CLASS, ' ', FILL_CLASS_PREFIX, color_index)));
+        }
+        else {
+            text.SetFontSize(settings_.bus_label_font_size)
                 .SetFontFamily("Verdana"s)
-                .SetFontWeight("bold"s)
-                .SetData(route->name);
-
+                .SetFontWeight("bold"s);
             doc.Add(CreateUnderlay(text, settings_));
-            doc.Add(text.SetFillColor(settings_.color_palette.at(index_color)));
-        } while (std::exchange(stop, final_stop) != final_stop);
-
-        ++index_color %= count_color;
-    }
+            doc.Add(text.SetFillColor(settings_.color_palette.at(color_index)));
+        }
+    } while (std::exchange(stop, final_stop) != final_stop);
 }
 
-void MapRenderer::RenderStop(const std::set<const Stop*>& stops, const SphereProjector& proj, Document& doc) const {
+void MapRenderer::RenderStop(const Stop* stop, const SphereProjector& proj, ObjectContainer& doc) const {
     auto circle = Circle()
-        .SetRadius(settings_.stop_radius)
-        .SetFillColor("white"s);
-
-    for (auto stop : stops) {
-        doc.Add(circle.SetCenter(proj(stop->coordinate)));
+        .SetCenter(proj(stop->coordinate))
+        .SetRadius(settings_.stop_radius);
+    if (settings_.compact_svg) {
+        circle.SetClass(std::string(STOP_CLASS));
+    }
+    else {
+        circle.SetFillColor("white"s);
     }
+    doc.Add(std::move(circle));
 }
 
-void MapRenderer::RenderStopName(const std::set<const Stop*>& stops, const SphereProjector& proj, Document& doc) const {
-    for (auto stop : stops) {
-        auto text = Text()
-            .SetPosition(proj(stop->coordinate))
-            .SetOffset(settings_.stop_label_offset)
-            .SetFontSize(settings_.stop_label_font_size)
-            .SetFontFamily("Verdana"s)
-            .SetData(stop->name);
+void MapRenderer::RenderStopName(const Stop* stop, const SphereProjector& proj, ObjectContainer& doc) const {
+    auto text = Text()
+        .SetPosition(proj(stop->coordinate))
+        .SetOffset(settings_.stop_label_offset)
+        .SetData(stop->name);
 
+    if (settings_.compact_svg) {
+        text.SetFontSize(std::nullopt);
+        doc.Add(Text(text).SetClass(Concat(STOP_LABEL_CLASS, ' ', UNDERLAY_CLASS)));
+        doc.Add(text.SetClass(std::string(STOP_LABEL_CLASS)));
+    }
+    else {
+        text.SetFontSize(settings_.stop_label_font_size)
+            .SetFontFamily("Verdana"s);
         doc.Add(CreateUnderlay(text, settings_));
         doc.Add(text.SetFillColor("black"s));
     }
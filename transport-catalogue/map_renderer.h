@@ -1,10 +1,13 @@
 #pragma once
 #include "domain.h"
+#include "map_index.h"
+#include "parallel.h"
 #include "svg.h"
 
 #include <algorithm>
 #include <cstdlib>
 #include <optional>
+#include <ostream>
 #include <set>
 #include <string_view>
 #include <vector>
@@ -28,8 +31,18 @@ struct RenderSettings {
     svg::Color underlayer_color;
     double underlayer_width = 0.0;
     std::vector<svg::Color> color_palette;
+
+    // Допуск упрощения карты в пикселях; 0 — карта без упрощения.
+    // Из линий маршрутов убираются вершины, отклоняющиеся от упрощённой линии не больше допуска,
+    // а подпись остановки не выводится, если ближе допуска уже есть подпись другой остановки
+    double simplify_tolerance = 0.0;
+    // Общие свойства элементов задаются классами в одном элементе <style>, а не атрибутами каждого
+    bool compact_svg = false;
 };
 
+// Карты с равными настройками совпадают
+bool operator==(const RenderSettings& lhs, const RenderSettings& rhs);
+
 inline const double EPSILON = 1e-6;
 bool IsZero(double value);
 
@@ -39,26 +52,22 @@ public:
     template <typename PointInputIt>
     SphereProjector(PointInputIt points_begin, PointInputIt points_end,
         double max_width, double max_height, double padding)
+        : SphereProjector(GetBounds(points_begin, points_end), max_width, max_height, padding) {
+    }
+
+    // bounds — границы проецируемых точек; nullopt, если точек нет
+    SphereProjector(const std::optional<geo::Bounds>& bounds, double max_width, double max_height, double padding)
         : padding_(padding) //
     {
         // Если точки поверхности сферы не заданы, вычислять нечего
-        if (points_begin == points_end) {
+        if (!bounds) {
             return;
         }
 
-        // Находим точки с минимальной и максимальной долготой
-        const auto [left_it, right_it] = std::minmax_element(
-            points_begin, points_end,
-            [](auto lhs, auto rhs) { return lhs.lng < rhs.lng; });
-        min_lon_ = left_it->lng;
-        const double max_lon = right_it->lng;
-
-        // Находим точки с минимальной и максимальной широтой
-        const auto [bottom_it, top_it] = std::minmax_element(
-            points_begin, points_end,
-            [](auto lhs, auto rhs) { return lhs.lat < rhs.lat; });
-        const double min_lat = bottom_it->lat;
-        max_lat_ = top_it->lat;
+        min_lon_ = bounds->min.lng;
+        const double max_lon = bounds->max.lng;
+        const double min_lat = bounds->min.lat;
+        max_lat_ = bounds->max.lat;
 
         // Вычисляем коэффициент масштабирования вдоль координаты x
         std::optional<double> width_zoom;
@@ -95,11 +104,26 @@ public:
         };
     }
 
+    // Число пикселей в градусе широты и долготы
+    double GetZoom() const {
+        return zoom_coeff_;
+    }
+
 private:
     double padding_;
     double min_lon_ = 0;
     double max_lat_ = 0;
     double zoom_coeff_ = 0;
+
+    template <typename PointInputIt>
+    static std::optional<geo::Bounds> GetBounds(PointInputIt points_begin, PointInputIt points_end) {
+        if (points_begin == points_end) {
+            return std::nullopt;
+        }
+        geo::Bounds bounds{ *points_begin, *points_begin };
+        std::for_each(points_begin, points_end, [&bounds](geo::Coordinates point) { bounds.Extend(point); });
+        return bounds;
+    }
 };
 
 class MapRenderer {
@@ -108,15 +132,59 @@ public:
         : settings_(settings) {
     }
 
-    svg::Document RenderMap(const std::set<const catalog::Bus*>& routes) const;
+    // Карта маршрутов routes; bounds — границы их остановок (TransportCatalogue::GetRouteBounds),
+    // по которым карта растягивается на всё изображение
+    svg::Document RenderMap(const std::set<const catalog::Bus*>& routes,
+                            const std::optional<geo::Bounds>& bounds) const;
+    // Добавляет объекты карты в doc; с svg::StreamDocument карта выводится, не сохраняя объекты
+    void RenderMap(const std::set<const catalog::Bus*>& routes, const std::optional<geo::Bounds>& bounds,
+                   svg::ObjectContainer& doc) const;
+    // Выводит карту svg-документом в out. Слои делятся не больше чем на thread_count частей,
+    // которые рисуют вызывающий поток и помощники, запущенные через spawn, в отдельные буферы.
+    // Части склеиваются по порядку, поэтому документ не зависит от числа потоков
+    void RenderMap(const std::set<const catalog::Bus*>& routes, const std::optional<geo::Bounds>& bounds,
+                   std::ostream& out, size_t thread_count, const parallel::Spawn& spawn) const;
+    // Выводит часть карты в области bounds, растянутой на всё изображение так же,
+    // как полная карта растягивается по своим остановкам. Маршруты сохраняют цвета полной карты,
+    // а содержимое области берётся из index, поэтому остальная карта не обходится.
+    // Линии маршрутов обрезаются по области
+    void RenderArea(const MapIndex& index, const GeoBounds& bounds, std::ostream& out,
+                    size_t thread_count, const parallel::Spawn& spawn) const;
 
 private:
+    // Объекты карты по слоям в порядке вывода
+    struct Layers {
+        // линии и названия маршрутов
+        std::vector<ColoredRoute> routes;
+        // кружки остановок
+        std::vector<const catalog::Stop*> stops;
+        // названия остановок, оставшиеся после прореживания
+        std::vector<const catalog::Stop*> labels;
+        // область, по которой обрезаются маршруты: выводятся только проходящие через неё отрезки линий
+        // и названия у конечных остановок внутри неё; nullopt — маршруты выводятся целиком
+        std::optional<GeoBounds> area;
+
+        // Общее число объектов слоёв: у маршрута по линии и названию
+        size_t GetSize() const {
+            return 2 * routes.size() + stops.size() + labels.size();
+        }
+    };
+
     RenderSettings settings_;
 
-    void RenderRoute(const std::set<const catalog::Bus*>& routes, const SphereProjector& proj, svg::Document& doc) const;
-    void RenderRouteName(const std::set<const catalog::Bus*>& routes, const SphereProjector& proj, svg::Document& doc) const;
-    void RenderStop(const std::set<const catalog::Stop*>& stops, const SphereProjector& proj, svg::Document& doc) const;
-    void RenderStopName(const std::set<const catalog::Stop*>& stops, const SphereProjector& proj, svg::Document& doc) const;
+    Layers MakeLayers(std::vector<ColoredRoute> routes, std::vector<const catalog::Stop*> stops,
+                      const SphereProjector& proj) const;
+    // Рисует объекты слоёв с номерами [begin, end) в порядке слоёв
+    void RenderLayers(const Layers& layers, size_t begin, size_t end,
+                      const SphereProjector& proj, svg::ObjectContainer& doc) const;
+    void RenderLayers(const Layers& layers, const SphereProjector& proj, std::ostream& out,
+                      size_t thread_count, const parallel::Spawn& spawn) const;
+    void RenderRoute(const ColoredRoute& route, const SphereProjector& proj, const std::optional<GeoBounds>& area,
+                     svg::ObjectContainer& doc) const;
+    void RenderRouteName(const ColoredRoute& route, const SphereProjector& proj, const std::optional<GeoBounds>& area,
+                         svg::ObjectContainer& doc) const;
+    void RenderStop(const catalog::Stop* stop, const SphereProjector& proj, svg::ObjectContainer& doc) const;
+    void RenderStopName(const catalog::Stop* stop, const SphereProjector& proj, svg::ObjectContainer& doc) const;
 };
 
 template <typename Iterator>
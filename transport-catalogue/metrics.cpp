@@ -0,0 +1,315 @@
+#include "json_writer.h"
+#include "metrics.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+namespace metrics {
+
+using namespace std::literals;
+
+#ifndef TC_DISABLE_METRICS
+
+namespace detail {
+
+constexpr std::array<std::string_view, static_cast<size_t>(Query::COUNT)> QUERY_NAMES = {
+    "Stop"sv, "Bus"sv, "Map"sv, "Route"sv, "Stats"sv, "MapArea"sv, "NearestStops"sv, "Invalid"sv
+};
+constexpr std::array<std::string_view, static_cast<size_t>(Timing::COUNT)> TIMING_NAMES = {
+    "catalogue_load"sv, "graph_build"sv, "router_precompute"sv
+};
+
+// Увеличивает счётчик, в который пишет только текущий поток
+void Increment(std::atomic<uint64_t>& counter, uint64_t value = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+struct QueryMetrics {
+    std::atomic<uint64_t> count = 0;
+    std::atomic<uint64_t> not_found = 0;
+    // задержки запросов, попавших в выборку
+    LatencyHistogram latency;
+};
+
+struct Shard {
+    std::array<QueryMetrics, static_cast<size_t>(Query::COUNT)> queries;
+
+    void Merge(const Shard& other) {
+        for (size_t i = 0; i < queries.size(); ++i) {
+            Increment(queries[i].count, other.queries[i].count.load(std::memory_order_relaxed));
+            Increment(queries[i].not_found, other.queries[i].not_found.load(std::memory_order_relaxed));
+            queries[i].latency.Merge(other.queries[i].latency);
+        }
+    }
+};
+
+/*
+ * Счётчики всех потоков. Поток регистрирует свои счётчики при первом запросе,
+ * а при завершении переносит их в retired, поэтому накопленное им не теряется
+ */
+class ShardRegistry {
+public:
+    void Register(const Shard* shard) {
+        std::lock_guard lock(mutex_);
+        shards_.push_back(shard);
+    }
+
+    void Unregister(const Shard* shard) {
+        std::lock_guard lock(mutex_);
+        retired_.Merge(*shard);
+        shards_.erase(std::find(shards_.begin(), shards_.end(), shard));
+    }
+
+    // Вызывает func для счётчиков каждого потока, включая завершившиеся
+    template <typename Func>
+    void ForEach(Func func) const {
+        std::lock_guard lock(mutex_);
+        func(retired_);
+        for (const Shard* shard : shards_) {
+            func(*shard);
+        }
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::vector<const Shard*> shards_;
+    Shard retired_;
+};
+
+ShardRegistry& GetRegistry() {
+    static ShardRegistry registry;
+    return registry;
+}
+
+// счётчики текущего потока, зарегистрированные на время его жизни
+class LocalShard {
+public:
+    LocalShard()
+        : shard_(std::make_unique<Shard>()) {
+        GetRegistry().Register(shard_.get());
+    }
+
+    ~LocalShard() {
+        GetRegistry().Unregister(shard_.get());
+    }
+
+    Shard& Get() {
+        return *shard_;
+    }
+
+private:
+    std::unique_ptr<Shard> shard_;
+};
+
+Shard& GetLocalShard() {
+    thread_local LocalShard shard;
+    return shard.Get();
+}
+
+struct TimingMetrics {
+    std::atomic<uint64_t> total = 0;
+    std::atomic<uint64_t> count = 0;
+};
+
+TimingMetrics timings[static_cast<size_t>(Timing::COUNT)];
+
+// Номер старшего единичного бита; value > 0
+int GetExponent(uint64_t value) {
+    int result = 0;
+    for (int shift = 32; shift > 0; shift /= 2) {
+        if (value >> shift) {
+            value >>= shift;
+            result += shift;
+        }
+    }
+    return result;
+}
+
+uint64_t ToNanoseconds(Clock::duration duration) {
+    const auto count = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    return count > 0 ? static_cast<uint64_t>(count) : 0;
+}
+
+void LatencyHistogram::Record(uint64_t nanoseconds) {
+    Increment(counts_[GetBucket(nanoseconds)]);
+    if (nanoseconds > max_.load(std::memory_order_relaxed)) {
+        max_.store(nanoseconds, std::memory_order_relaxed);
+    }
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other) {
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        Increment(counts_[i], other.counts_[i].load(std::memory_order_relaxed));
+    }
+    max_.store(std::max(max_.load(std::memory_order_relaxed), other.max_.load(std::memory_order_relaxed)),
+               std::memory_order_relaxed);
+}
+
+void LatencyHistogram::AddTo(std::array<uint64_t, BUCKET_COUNT>& counts, uint64_t& max) const {
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        counts[i] += counts_[i].load(std::memory_order_relaxed);
+    }
+    max = std::max(max, max_.load(std::memory_order_relaxed));
+}
+
+size_t LatencyHistogram::GetBucket(uint64_t nanoseconds) {
+    // Значения меньше SUB_BUCKET_COUNT хранятся точно, по корзине на значение
+    if (nanoseconds < SUB_BUCKET_COUNT) {
+        return static_cast<size_t>(nanoseconds);
+    }
+    const int exponent = GetExponent(nanoseconds);
+    if (exponent > MAX_EXPONENT) {
+        return BUCKET_COUNT - 1;
+    }
+    const int shift = exponent - SUB_BUCKET_BITS;
+    const size_t sub_bucket = static_cast<size_t>(nanoseconds >> shift) - SUB_BUCKET_COUNT;
+    return static_cast<size_t>(shift + 1) * SUB_BUCKET_COUNT + sub_bucket;
+}
+
+uint64_t LatencyHistogram::GetUpperBound(size_t bucket) {
+    const size_t range = bucket / SUB_BUCKET_COUNT;
+    if (range == 0) {
+        return bucket;
+    }
+    const size_t shift = range - 1;
+    const uint64_t lower = static_cast<uint64_t>(SUB_BUCKET_COUNT + bucket % SUB_BUCKET_COUNT) << shift;
+    return lower + (uint64_t{ 1 } << shift) - 1;
+}
+
+void CountQuery(Shard& shard, Query query, bool is_found) {
+    QueryMetrics& metrics = shard.queries[static_cast<size_t>(query)];
+    Increment(metrics.count);
+    if (!is_found) {
+        Increment(metrics.not_found);
+    }
+}
+
+void RecordQuery(Shard& shard, Query query, bool is_found, Clock::duration latency) {
+    CountQuery(shard, query, is_found);
+    shard.queries[static_cast<size_t>(query)].latency.Record(ToNanoseconds(latency));
+}
+
+void AddTiming(Timing timing, Clock::duration duration) {
+    TimingMetrics& metrics = timings[static_cast<size_t>(timing)];
+    metrics.total.fetch_add(ToNanoseconds(duration), std::memory_order_relaxed);
+    metrics.count.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Счётчики выводятся как int JSON
+int ToInt(uint64_t value) {
+    return static_cast<int>(std::min<uint64_t>(value, INT_MAX));
+}
+
+double ToSeconds(uint64_t nanoseconds) {
+    return nanoseconds * 1e-9;
+}
+
+// Записывает число запросов, ответы "not found" и квантили задержки в секундах
+void WriteQuery(json::Writer& writer, size_t query) {
+    std::array<uint64_t, BUCKET_COUNT> counts{};
+    uint64_t max = 0;
+    uint64_t count = 0;
+    uint64_t not_found = 0;
+    GetRegistry().ForEach([&](const Shard& shard) {
+        const QueryMetrics& metrics = shard.queries[query];
+        count += metrics.count.load(std::memory_order_relaxed);
+        not_found += metrics.not_found.load(std::memory_order_relaxed);
+        metrics.latency.AddTo(counts, max);
+    });
+    uint64_t total = 0;
+    for (const uint64_t bucket_count : counts) {
+        total += bucket_count;
+    }
+
+    writer.StartDict()
+        .Key("count"sv).Value(ToInt(count))
+        .Key("not_found"sv).Value(ToInt(not_found));
+    if (total > 0) {
+        // Квантиль — верхняя граница корзины, до которой набирается нужная доля запросов
+        const auto get_quantile = [&counts, &max, total](double quantile) {
+            const auto rank = std::max<uint64_t>(static_cast<uint64_t>(std::ceil(quantile * total)), 1);
+            uint64_t seen = 0;
+            for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+                seen += counts[i];
+                if (seen >= rank) {
+                    return ToSeconds(std::min(LatencyHistogram::GetUpperBound(i), max));
+                }
+            }
+            return ToSeconds(max);
+        };
+        writer.Key("latency"sv).StartDict()
+            .Key("p50"sv).Value(get_quantile(0.5))
+            .Key("p90"sv).Value(get_quantile(0.9))
+            .Key("p99"sv).Value(get_quantile(0.99))
+            .Key("max"sv).Value(ToSeconds(max))
+            .Key("samples"sv).Value(ToInt(total))
+            .EndDict();
+    }
+    writer.EndDict();
+}
+
+} // namespace detail
+
+using namespace detail;
+
+void WriteStats(json::Writer& writer) {
+    writer.Key("queries"sv).StartDict();
+    for (size_t query = 0; query < QUERY_NAMES.size(); ++query) {
+        writer.Key(QUERY_NAMES[query]);
+        WriteQuery(writer, query);
+    }
+    writer.EndDict();
+
+    writer.Key("timings"sv).StartDict();
+    for (size_t timing = 0; timing < TIMING_NAMES.size(); ++timing) {
+        writer.Key(TIMING_NAMES[timing]).StartDict()
+            .Key("count"sv).Value(ToInt(timings[timing].count.load(std::memory_order_relaxed)))
+            .Key("total"sv).Value(ToSeconds(timings[timing].total.load(std::memory_order_relaxed)))
+            .EndDict();
+    }
+    writer.EndDict();
+}
+
+#else
+
+namespace detail {
+
+struct Shard {
+};
+
+Shard& GetLocalShard() {
+    static Shard shard;
+    return shard;
+}
+
+void CountQuery(Shard&, Query, bool) {
+}
+
+void RecordQuery(Shard&, Query, bool, Clock::duration) {
+}
+
+void AddTiming(Timing, Clock::duration) {
+}
+
+} // namespace detail
+
+void WriteStats(json::Writer&) {
+}
+
+#endif
+
+void PrintStats(std::ostream& out) {
+    json::Writer writer(out);
+    writer.StartDict();
+    WriteStats(writer);
+    writer.EndDict();
+    writer.Finish();
+    out << '\n';
+}
+
+} // namespace metrics
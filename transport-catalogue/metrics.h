@@ -0,0 +1,174 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+namespace json {
+class Writer;
+} // namespace json
+
+/*
+ * Метрики процесса: гистограммы задержек и счётчики stat-запросов по типам,
+ * время загрузки каталога и построения маршрутизатора. Накапливаются за всё время работы
+ * и выводятся запросом Stats. Сборка с -DTC_DISABLE_METRICS исключает их полностью
+ */
+namespace metrics {
+
+#ifdef TC_DISABLE_METRICS
+inline constexpr bool ENABLED = false;
+#else
+inline constexpr bool ENABLED = true;
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+// типы stat-запросов в порядке StatRequest::query
+enum class Query {
+    STOP,
+    BUS,
+    MAP,
+    ROUTE,
+    STATS,
+    MAP_AREA,
+    NEAREST_STOPS,
+    // запросы, которые не удалось разобрать
+    INVALID,
+    COUNT
+};
+
+// однократные или редкие этапы работы, время которых суммируется
+enum class Timing {
+    // разбор base_requests и заполнение каталога
+    CATALOGUE_LOAD,
+    // построение графа маршрутизатора
+    GRAPH_BUILD,
+    // построение деревьев кратчайших путей от остановок отправления
+    ROUTER_PRECOMPUTE,
+    COUNT
+};
+
+namespace detail {
+
+// Диапазон [2^k, 2^(k+1)) наносекунд делится на SUB_BUCKET_COUNT корзин,
+// поэтому верхняя граница корзины больше записанного значения не более чем на 1/16
+constexpr int SUB_BUCKET_BITS = 4;
+constexpr size_t SUB_BUCKET_COUNT = size_t{ 1 } << SUB_BUCKET_BITS;
+// Значения от 2^40 нс (около 18 минут) попадают в последнюю корзину
+constexpr int MAX_EXPONENT = 40;
+constexpr size_t BUCKET_COUNT = SUB_BUCKET_COUNT * (MAX_EXPONENT - SUB_BUCKET_BITS + 2);
+// Задержка измеряется у каждого LATENCY_SAMPLE_PERIOD-го запроса потока:
+// обращение к часам дороже остального учёта
+constexpr size_t LATENCY_SAMPLE_PERIOD = 8;
+
+/*
+ * Гистограмма задержек в духе HdrHistogram: логарифмические диапазоны
+ * с линейным делением внутри. Писать в гистограмму может только один поток,
+ * поэтому запись обходится без блокирующих инструкций; читать можно из любого потока
+ */
+class LatencyHistogram {
+public:
+    void Record(uint64_t nanoseconds);
+    // Добавляет записи other к этой гистограмме
+    void Merge(const LatencyHistogram& other);
+    // Добавляет число записей каждой корзины в counts
+    void AddTo(std::array<uint64_t, BUCKET_COUNT>& counts, uint64_t& max) const;
+
+    static size_t GetBucket(uint64_t nanoseconds);
+    // Наибольшее значение, попадающее в корзину
+    static uint64_t GetUpperBound(size_t bucket);
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKET_COUNT> counts_{};
+    std::atomic<uint64_t> max_ = 0;
+};
+
+// счётчики stat-запросов одного потока
+struct Shard;
+
+// Счётчики текущего потока; пишет в них только он
+Shard& GetLocalShard();
+void CountQuery(Shard& shard, Query query, bool is_found);
+void RecordQuery(Shard& shard, Query query, bool is_found, Clock::duration latency);
+void AddTiming(Timing timing, Clock::duration duration);
+
+} // namespace detail
+
+// Добавляет длительность этапа
+inline void AddTiming([[maybe_unused]] Timing timing, [[maybe_unused]] Clock::duration duration) {
+    if constexpr (ENABLED) {
+        detail::AddTiming(timing, duration);
+    }
+}
+
+/*
+ * Учитывает stat-запросы, выполняемые подряд в одном потоке. Задержка запроса
+ * отсчитывается от конца предыдущего и измеряется выборочно (см. LATENCY_SAMPLE_PERIOD),
+ * начиная с первого запроса; число запросов и ответов "not found" учитывается точно
+ */
+class QueryTimer {
+public:
+    QueryTimer() {
+        if constexpr (ENABLED) {
+            shard_ = &detail::GetLocalShard();
+            last_ = Clock::now();
+        }
+    }
+
+    // Учитывает запрос, выполненный после предыдущего вызова;
+    // is_found — false для ответов "not found"
+    void Record([[maybe_unused]] Query query, [[maybe_unused]] bool is_found) {
+        if constexpr (ENABLED) {
+            if (sample_index_ == 0) {
+                detail::RecordQuery(*shard_, query, is_found, Clock::now() - last_);
+            }
+            else {
+                detail::CountQuery(*shard_, query, is_found);
+            }
+            if (++sample_index_ == detail::LATENCY_SAMPLE_PERIOD) {
+                sample_index_ = 0;
+                last_ = Clock::now();
+            }
+        }
+    }
+
+private:
+    detail::Shard* shard_ = nullptr;
+    Clock::time_point last_;
+    // номер запроса в периоде выборки; у нулевого измеряется задержка
+    size_t sample_index_ = 0;
+};
+
+// Измеряет время жизни объекта и добавляет его к этапу timing
+class ScopedTiming {
+public:
+    explicit ScopedTiming(Timing timing)
+        : timing_(timing) {
+        if constexpr (ENABLED) {
+            start_ = Clock::now();
+        }
+    }
+
+    ScopedTiming(const ScopedTiming&) = delete;
+    ScopedTiming& operator=(const ScopedTiming&) = delete;
+
+    ~ScopedTiming() {
+        if constexpr (ENABLED) {
+            AddTiming(timing_, Clock::now() - start_);
+        }
+    }
+
+private:
+    Timing timing_;
+    Clock::time_point start_;
+};
+
+// Записывает в открытый словарь writer ключи "queries" и "timings" с накопленными метриками.
+// Если метрики отключены при сборке, ничего не записывает
+void WriteStats(json::Writer& writer);
+// Выводит метрики словарём JSON
+void PrintStats(std::ostream& out);
+
+} // namespace metrics
@@ -0,0 +1,85 @@
+#include "parallel.h"
+
+namespace parallel {
+
+ThreadPool::ThreadPool(size_t thread_count) {
+    thread_count = std::max<size_t>(thread_count, 1);
+    queues_.reserve(thread_count);
+    for (size_t i = 0; i < thread_count; ++i) {
+        queues_.push_back(std::make_unique<Queue>());
+    }
+    workers_.reserve(thread_count);
+    for (size_t i = 0; i < thread_count; ++i) {
+        workers_.emplace_back([this, i] { WorkerLoop(i); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock(mutex_);
+        is_stopped_ = true;
+    }
+    cv_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+size_t ThreadPool::GetThreadCount() const {
+    return workers_.size();
+}
+
+void ThreadPool::Push(std::function<void()> task) {
+    {
+        // Счётчик увеличивается под mutex_ и до постановки задачи,
+        // чтобы ожидающий поток не пропустил уведомление, а счётчик не уходил в минус
+        std::lock_guard lock(mutex_);
+        ++pending_;
+    }
+    Queue& queue = *queues_[next_queue_++ % queues_.size()];
+    {
+        std::lock_guard lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+    cv_.notify_one();
+}
+
+bool ThreadPool::TryPop(size_t index, std::function<void()>& task) {
+    // Сначала берём задачи из начала своей очереди, затем перехватываем из конца чужих
+    for (size_t i = 0; i < queues_.size(); ++i) {
+        Queue& queue = *queues_[(index + i) % queues_.size()];
+        std::lock_guard lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            continue;
+        }
+        if (i == 0) {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        else {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+        --pending_;
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::WorkerLoop(size_t index) {
+    std::function<void()> task;
+    while (true) {
+        if (TryPop(index, task)) {
+            task();
+            task = nullptr;
+            continue;
+        }
+        std::unique_lock lock(mutex_);
+        cv_.wait(lock, [this] { return is_stopped_ || pending_ > 0; });
+        if (is_stopped_ && pending_ == 0) {
+            return;
+        }
+    }
+}
+
+} // namespace parallel
@@ -0,0 +1,179 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace parallel {
+
+// Число рабочих потоков по умолчанию
+inline size_t GetThreadCount() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/*
+ * Делит диапазон индексов [0, count) на непрерывные части не короче min_chunk
+ * и вызывает func(begin, end) для каждой части в отдельном потоке.
+ * Последняя часть обрабатывается в вызывающем потоке.
+ * Исключение из любой части пробрасывается после завершения всех потоков
+ */
+template <typename Func>
+void ForEachChunk(size_t count, size_t min_chunk, Func func, size_t thread_count = GetThreadCount()) {
+    if (count == 0) {
+        return;
+    }
+    const size_t chunk_count = std::clamp<size_t>(count / std::max<size_t>(min_chunk, 1), 1, thread_count);
+    const size_t chunk_size = count / chunk_count;
+    const size_t remainder = count % chunk_count;
+
+    std::vector<std::future<void>> futures;
+    futures.reserve(chunk_count - 1);
+    size_t begin = 0;
+    for (size_t i = 0; i + 1 < chunk_count; ++i) {
+        const size_t end = begin + chunk_size + (i < remainder ? 1 : 0);
+        futures.push_back(std::async(std::launch::async, [&func, begin, end] { func(begin, end); }));
+        begin = end;
+    }
+
+    std::exception_ptr last_error;
+    try {
+        func(begin, count);
+    }
+    catch (...) {
+        last_error = std::current_exception();
+    }
+    // Дожидаемся всех потоков и пробрасываем исключение из самой первой части
+    std::exception_ptr error;
+    for (auto& future : futures) {
+        try {
+            future.get();
+        }
+        catch (...) {
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+    if (!error) {
+        error = last_error;
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+// Запускает задачу в другом потоке. Возвращает false, если свободного потока нет
+using Spawn = std::function<bool(std::function<void()>)>;
+
+/*
+ * То же, но части разбирают вызывающий поток и помощники, которых удалось запустить через spawn,
+ * поэтому потоков не больше, чем их выделяет владелец spawn. Вызывающий поток ждёт только
+ * частей, которые уже начаты: помощник, запущенный после того, как части кончились,
+ * не обращается к func и сразу завершается
+ */
+template <typename Func>
+void ForEachChunk(size_t count, size_t min_chunk, Func func, size_t thread_count, const Spawn& spawn) {
+    if (count == 0) {
+        return;
+    }
+    const size_t chunk_count = std::clamp<size_t>(count / std::max<size_t>(min_chunk, 1), 1, thread_count);
+    const size_t chunk_size = count / chunk_count;
+    const size_t remainder = count % chunk_count;
+
+    struct State {
+        std::mutex mutex;
+        std::condition_variable cv;
+        // следующая часть и число частей, которые сейчас обрабатываются
+        size_t next = 0;
+        size_t working = 0;
+        std::exception_ptr error;
+    };
+    const auto state = std::make_shared<State>();
+    const auto work = [state, &func, chunk_count, chunk_size, remainder] {
+        std::unique_lock lock(state->mutex);
+        while (state->next < chunk_count) {
+            const size_t index = state->next++;
+            ++state->working;
+            lock.unlock();
+            const size_t begin = index * chunk_size + std::min(index, remainder);
+            const size_t end = begin + chunk_size + (index < remainder ? 1 : 0);
+            std::exception_ptr error;
+            try {
+                func(begin, end);
+            }
+            catch (...) {
+                error = std::current_exception();
+            }
+            lock.lock();
+            if (error && !state->error) {
+                state->error = error;
+            }
+            --state->working;
+        }
+        state->cv.notify_all();
+    };
+
+    for (size_t i = 0; spawn && i + 1 < chunk_count && spawn(work); ++i) {
+    }
+    work();
+    std::unique_lock lock(state->mutex);
+    state->cv.wait(lock, [&state] { return state->working == 0; });
+    if (state->error) {
+        std::rethrow_exception(state->error);
+    }
+}
+
+/*
+ * Пул потоков с перехватом задач: у каждого потока своя очередь,
+ * а освободившийся поток забирает задачи из конца чужих очередей
+ */
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t thread_count = parallel::GetThreadCount());
+    // Дожидается выполнения всех поставленных задач
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Ставит задачу в очередь. Результат или исключение задачи передаются через future
+    template <typename Func>
+    auto Submit(Func func) {
+        using Result = std::invoke_result_t<Func>;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::move(func));
+        auto result = task->get_future();
+        Push([task] { (*task)(); });
+        return result;
+    }
+
+    size_t GetThreadCount() const;
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::atomic<size_t> pending_ = 0;
+    std::atomic<size_t> next_queue_ = 0;
+    bool is_stopped_ = false;
+
+    void Push(std::function<void()> task);
+    bool TryPop(size_t index, std::function<void()>& task);
+    void WorkerLoop(size_t index);
+};
+
+} // namespace parallel
@@ -1,5 +1,19 @@
+#include "metrics.h"
+#include "parallel.h"
 #include "request_handler.h"
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <numeric>
+#include <type_traits>
+#include <variant>
+
 namespace handler {
 
 using namespace catalog;
@@ -8,312 +22,941 @@ using namespace renderer;
 using namespace routemap;
 using namespace std::literals;
 
-class StatQuery {
+// Число блоков в очереди между стадиями конвейера на один поток выполнения
+constexpr size_t QUEUE_BLOCKS_PER_THREAD = 4;
+
+/*
+ * Компонент, который создаётся при первом обращении к нему, и время его создания.
+ * Обращаться к компоненту можно из нескольких потоков одновременно
+ */
+template <typename T>
+class Lazy {
 public:
-    StatQuery(int id) : id_(id) {}
-    virtual ~StatQuery() = default;
-    virtual Node Process(const TransportCatalogue&, const MapRenderer&, const TransportRouter&) const = 0;
+    explicit Lazy(std::function<void(std::optional<T>&)> init)
+        : init_(std::move(init)) {
+    }
 
-protected:
-    int GetId() const {
-        return id_;
+    Lazy(const Lazy&) = delete;
+    Lazy& operator=(const Lazy&) = delete;
+
+    const T& Get() const {
+        std::call_once(once_, [this] {
+            const auto start = std::chrono::steady_clock::now();
+            init_(value_);
+            build_time_ = std::chrono::steady_clock::now() - start;
+        });
+        return *value_;
     }
 
-    Node Build(std::string str = "not found") const {
-        return Builder{}.StartDict()
-            .Key("request_id"s).Value(id_)
-            .Key("error_message"s).Value(std::move(str))
-            .EndDict().Build();
+    // Время создания; nullopt, если компонент не понадобился.
+    // Вызывать после того, как все обращения к Get завершены
+    std::optional<BatchStats::Duration> GetBuildTime() const {
+        return build_time_;
     }
 
 private:
-    int id_;
+    std::function<void(std::optional<T>&)> init_;
+    mutable std::once_flag once_;
+    mutable std::optional<T> value_;
+    mutable std::optional<BatchStats::Duration> build_time_;
 };
 
-class StatQueryFactory {
+/*
+ * Источник маршрутизатора для запросов Route и WalkRoute: маршрутизатор берётся из кэша
+ * и строится, только если его ещё нет для текущей версии каталога
+ */
+class RouterProvider {
 public:
-    virtual ~StatQueryFactory() = default;
-    virtual std::unique_ptr<StatQuery> Create(const StatRequest& config) const {
-        return GetFactory(config.params.at("type")).Create(config);
+    RouterProvider(const TransportCatalogue& db, RoutingSettings settings, RouterCache& cache)
+        : db_(db)
+        , settings_(settings)
+        , cache_(cache) {
     }
 
-private:
-    static const StatQueryFactory& GetFactory(std::string_view type);
-};
-
-void RequestHandler::ProcessBaseQuery(const BaseQueryHandler& bq_handler) const {
-    bq_handler.ProcessBaseQuery(db_);
-}
-
-std::vector<Node> RequestHandler::ProcessStatQuery(const std::vector<StatRequest>& requests,
-                                                   RenderSettings render_settings,
-                                                   RoutingSettings routing_settings) const
-{
-    MapRenderer renderer(render_settings);
-    TransportRouter router(routing_settings, db_);
+    RouterProvider(const RouterProvider&) = delete;
+    RouterProvider& operator=(const RouterProvider&) = delete;
+
+    const TransportRouter& Get() const {
+        std::call_once(once_, [this] {
+            router_ = cache_.Get(db_.GetVersion(), settings_, [this] {
+                const auto start = std::chrono::steady_clock::now();
+                auto router = std::make_shared<const TransportRouter>(settings_, db_);
+                build_time_ = std::chrono::steady_clock::now() - start;
+                return router;
+            });
+        });
+        return *router_;
+    }
 
-    std::vector<Node> result;
-    const StatQueryFactory factory;
-    for (const auto& config : requests) {
-        result.push_back(factory.Create(config)->Process(db_, renderer, router));
+    // Время построения; nullopt, если маршрутизатор не понадобился или взят из кэша.
+    // Вызывать после того, как все обращения к Get завершены
+    std::optional<BatchStats::Duration> GetBuildTime() const {
+        return build_time_;
     }
-    return result;
-}
 
-namespace base_queries {
+private:
+    const TransportCatalogue& db_;
+    RoutingSettings settings_;
+    RouterCache& cache_;
+    mutable std::once_flag once_;
+    mutable RouterCache::Value router_;
+    mutable std::optional<BatchStats::Duration> build_time_;
+};
 
-// добавляет остановки в каталог
-class QueryStop : public BaseQuery {
+/*
+ * Источник индекса остановок для запросов NearestStops и WalkRoute: индекс строится один раз
+ * для версии каталога и берётся из кэша, пока каталог не изменится
+ */
+class StopIndexProvider {
 public:
-    QueryStop(std::string_view name, geo::Coordinates coordinates)
-        : name_(name)
-        , coordinates_(coordinates) {
+    StopIndexProvider(const TransportCatalogue& db, StopIndexCache& cache)
+        : db_(db)
+        , cache_(cache) {
     }
 
-    void Process(catalog::TransportCatalogue& db) const override {
-        db.AddStop(name_, coordinates_);
+    StopIndexProvider(const StopIndexProvider&) = delete;
+    StopIndexProvider& operator=(const StopIndexProvider&) = delete;
+
+    const StopIndex& Get() const {
+        std::call_once(once_, [this] {
+            index_ = cache_.Get(db_.GetVersion(), {}, [this] {
+                return std::make_shared<const StopIndex>(db_.GetStops());
+            });
+        });
+        return *index_;
     }
 
 private:
-    std::string_view name_;
-    geo::Coordinates coordinates_;
+    const TransportCatalogue& db_;
+    StopIndexCache& cache_;
+    mutable std::once_flag once_;
+    mutable StopIndexCache::Value index_;
 };
 
-// добавляет дистанции между остановками в каталог
-class QueryStopDistance : public BaseQuery {
+/*
+ * Источник карты для запросов Map и MapArea: карта и индекс берутся из кэша,
+ * а рендерер создаётся, только если карту действительно нужно построить
+ */
+class MapProvider {
 public:
-    QueryStopDistance(std::string_view name, std::unordered_map<std::string_view, int> road_distances)
-        : name_(name)
-        , road_distances_(std::move(road_distances)) {
+    MapProvider(const TransportCatalogue& db, RenderSettings settings, MapCache& cache, MapIndexCache& index_cache,
+                size_t thread_count, parallel::Spawn spawn)
+        : db_(db)
+        , settings_(std::move(settings))
+        , thread_count_(thread_count)
+        , spawn_(std::move(spawn))
+        , cache_(cache)
+        , index_cache_(index_cache)
+        , renderer_([this](auto& value) { value.emplace(settings_); }) {
     }
 
-    void Process(TransportCatalogue& db) const override {
-        for (auto& [to, dist] : road_distances_) {
-            db.SetDistance(name_, to, dist);
-        }
+    MapProvider(const MapProvider&) = delete;
+    MapProvider& operator=(const MapProvider&) = delete;
+
+    MapCache::Value GetMapJson() const {
+        return cache_.Get(db_.GetVersion(), settings_, [this] {
+            auto result = std::make_shared<std::string>();
+            AppendStreamedString(*result, [this](std::ostream& out) {
+                renderer_.Get().RenderMap(db_.GetRoutes(), db_.GetRouteBounds(), out, thread_count_, spawn_);
+            });
+            return result;
+        });
     }
 
-private:
-    std::string_view name_;
-    std::unordered_map<std::string_view, int> road_distances_;
-};
+    // Рисует часть карты в области bounds, не сохраняя её; возвращает строковый литерал JSON
+    std::string RenderAreaJson(const GeoBounds& bounds) const {
+        std::string result;
+        AppendStreamedString(result, [this, &bounds](std::ostream& out) {
+            renderer_.Get().RenderArea(*GetIndex(), bounds, out, thread_count_, spawn_);
+        });
+        return result;
+    }
 
-// добавляет маршруты в каталог
-class QueryBus : public BaseQuery {
-public:
-    QueryBus(std::string_view name, std::vector<std::string_view> stops, bool is_roundtrip)
-        : name_(name)
-        , stops_(std::move(stops))
-        , is_roundtrip_(is_roundtrip) {
+    // Границы тайла; nullopt, если на карте нет маршрутов
+    std::optional<GeoBounds> GetTileBounds(Tile tile) const {
+        return GetIndex()->GetTileBounds(tile);
     }
 
-    void Process(TransportCatalogue& db) const override {
-        db.AddBus(name_, stops_, is_roundtrip_);
+    std::optional<BatchStats::Duration> GetBuildTime() const {
+        return renderer_.GetBuildTime();
     }
 
 private:
-    std::string_view name_;
-    std::vector<std::string_view> stops_;
-    bool is_roundtrip_ = false;
+    const TransportCatalogue& db_;
+    RenderSettings settings_;
+    // наибольшее число частей, на которые делится одна карта, и запуск помощников,
+    // которые рисуют её части вместе с потоком запроса
+    size_t thread_count_;
+    parallel::Spawn spawn_;
+    MapCache& cache_;
+    MapIndexCache& index_cache_;
+    Lazy<MapRenderer> renderer_;
+
+    MapIndexCache::Value GetIndex() const {
+        return index_cache_.Get(db_.GetVersion(), {}, [this] {
+            return std::make_shared<const MapIndex>(db_.GetRoutes());
+        });
+    }
 };
 
-} // namespace base_queries
+bool IsMapRequest(const StatRequest& request) {
+    return std::holds_alternative<StatRequest::Map>(request.query);
+}
+
+// всё, что нужно stat-запросам для ответа
+struct StatContext {
+    const TransportCatalogue& db;
+    const MapProvider& maps;
+    const RouterProvider& router;
+    const StopIndexProvider& stops;
+};
+
+// Выполняет запрос и записывает ответ в writer. Возвращает false, если ответ — "not found"
+bool ProcessStatRequest(const StatContext& context, const StatRequest& request, Writer& writer);
 
 namespace stat_queries {
 
-class StatQueryStop : public StatQuery {
-public:
-    StatQueryStop(int id, std::string_view name)
-        : StatQuery(id)
-        , name_(name) {
+// Записывает найденный маршрут или ответ "not found"
+void WriteRoute(Writer& writer, int id, const std::optional<FoundRoute>& route);
+
+} // namespace stat_queries
+
+// тип запроса в метриках
+struct MetricsQuery {
+    metrics::Query operator()(const StatRequest::Stop&) const {
+        return metrics::Query::STOP;
+    }
+    metrics::Query operator()(const StatRequest::Bus&) const {
+        return metrics::Query::BUS;
+    }
+    metrics::Query operator()(const StatRequest::Map&) const {
+        return metrics::Query::MAP;
+    }
+    metrics::Query operator()(const StatRequest::Route&) const {
+        return metrics::Query::ROUTE;
+    }
+    metrics::Query operator()(const StatRequest::Stats&) const {
+        return metrics::Query::STATS;
+    }
+    metrics::Query operator()(const StatRequest::MapArea&) const {
+        return metrics::Query::MAP_AREA;
     }
+    metrics::Query operator()(const StatRequest::NearestStops&) const {
+        return metrics::Query::NEAREST_STOPS;
+    }
+    metrics::Query operator()(const StatRequest::WalkRoute&) const {
+        return metrics::Query::ROUTE;
+    }
+    metrics::Query operator()(const StatRequest::Invalid&) const {
+        return metrics::Query::INVALID;
+    }
+};
 
-    Node Process(const TransportCatalogue& db, const MapRenderer&, const TransportRouter&) const override {
-        if (const auto& response = db.GetBusesByStop(name_)) {
-            return Build(response.value());
+/*
+ * Выполняет запросы блока с номерами indices и записывает ответы в responses;
+ * у запросов Map ответ остаётся пустым (см. WriteResponses). Запросы Route группируются
+ * по остановке отправления, и маршруты группы ищутся по одному дереву кратчайших путей.
+ * Запросы и их задержки учитываются в метриках (см. metrics.h)
+ */
+void ExecuteRequests(const StatContext& context, const StatBlock& block, const std::vector<size_t>& indices,
+                     Writer& block_writer, std::vector<std::string>& responses) {
+    const auto& requests = block.requests;
+    std::vector<size_t> routes;
+    metrics::QueryTimer timer;
+    for (const size_t i : indices) {
+        if (std::holds_alternative<StatRequest::Route>(requests[i].query)) {
+            routes.push_back(i);
+        }
+        else if (IsMapRequest(requests[i])) {
+            // Карта строится здесь, а выводится из кэша в WriteResponses
+            context.maps.GetMapJson();
+            timer.Record(metrics::Query::MAP, true);
+        }
+        else {
+            const bool is_found = ProcessStatRequest(context, requests[i], block_writer);
+            responses[i] = block_writer.TakeString();
+            timer.Record(std::visit(MetricsQuery{}, requests[i].query), is_found);
         }
-        return StatQuery::Build();
+    }
+    if (routes.empty()) {
+        return;
     }
 
-    class Factory : public StatQueryFactory {
-        std::unique_ptr<StatQuery> Create(const StatRequest& config) const override {
-            return std::make_unique<StatQueryStop>(config.id, config.params.at("name"sv));
-        }
+    const auto get_from = [&requests](size_t i) {
+        return std::get<StatRequest::Route>(requests[i].query).from;
     };
-private:
-    std::string_view name_;
+    std::stable_sort(routes.begin(), routes.end(),
+        [&get_from](size_t lhs, size_t rhs) { return get_from(lhs) < get_from(rhs); });
+
+    const TransportRouter& router = context.router.Get();
+    for (auto group = routes.begin(); group != routes.end();) {
+        const std::string_view from = get_from(*group);
+        const auto routes_from = router.GetRoutesFrom(from);
+        for (; group != routes.end() && get_from(*group) == from; ++group) {
+            const StatRequest& request = requests[*group];
+            const auto route = routes_from.To(std::get<StatRequest::Route>(request.query).to);
+            stat_queries::WriteRoute(block_writer, request.id, route);
+            responses[*group] = block_writer.TakeString();
+            // Задержка первого запроса группы включает построение дерева
+            timer.Record(metrics::Query::ROUTE, route.has_value());
+        }
+    }
+}
 
-    Node Build(const std::set<std::string_view>* buses) const {
-        return Builder{}.StartDict()
-            .Key("request_id"s).Value(GetId())
-            .Key("buses"s).Value(BuildArray(buses))
-            .EndDict().Build();
+// Выводит в writer ответы на запросы блока с номерами [begin, end);
+// ответы Map выводятся прямо из кэша, без копирования карты
+void WriteResponses(const StatContext& context, const StatBlock& block, const std::vector<std::string>& responses,
+                    size_t begin, size_t end, Writer& writer) {
+    for (size_t i = begin; i < end; ++i) {
+        if (responses[i].empty()) {
+            ProcessStatRequest(context, block.requests[i], writer);
+        }
+        else {
+            writer.RawValue(responses[i]);
+        }
     }
+}
+
+// Полоса выполнения запроса — номер его типа в StatRequest::query
+size_t GetLane(const StatRequest& request) {
+    return request.query.index();
+}
+
+constexpr size_t LANE_COUNT = std::variant_size_v<decltype(StatRequest::query)>;
+// названия полос в порядке типов StatRequest::query
+constexpr std::array<std::string_view, LANE_COUNT> LANE_NAMES = {
+    "Stop"sv, "Bus"sv, "Map"sv, "Route"sv, "Stats"sv, "MapArea"sv, "NearestStops"sv, "WalkRoute"sv, "Invalid"sv
+};
+// полосы в порядке приоритета: сначала дешёвые поиски в каталоге, ответы на ошибочные запросы и метрики,
+// затем маршруты, MapArea и Map
+constexpr std::array<size_t, LANE_COUNT> LANE_PRIORITY = { 0, 1, 8, 6, 4, 3, 7, 5, 2 };
+
+bool IsHeavyLane(size_t lane) {
+    return LANE_NAMES[lane] == "Map"sv || LANE_NAMES[lane] == "Route"sv || LANE_NAMES[lane] == "WalkRoute"sv
+        || LANE_NAMES[lane] == "MapArea"sv;
+}
+
+using Clock = std::chrono::steady_clock;
+
+// блок запросов на конвейере
+struct PipelineItem {
+    std::unique_ptr<StatBlock> block;
+    // ответы на запросы блока; пустая строка у запросов Map, которые выводятся при сериализации
+    std::vector<std::string> responses;
+    // момент разбора блока, от которого отсчитывается задержка его запросов
+    Clock::time_point parsed_at;
+    // полосы, которые выполнили свои запросы блока (под мьютексом конвейера)
+    std::array<bool, LANE_COUNT> is_lane_done{};
+};
 
-    std::vector<Node> BuildArray(const std::set<std::string_view>* buses) const {
-        std::vector<Node> result;
-        if (buses) {
-            for (std::string_view str : *buses) {
-                result.push_back(Builder{}.Value(std::string(str)).Build());
+// запросы одного блока, попавшие в одну полосу
+struct LaneTask {
+    std::shared_ptr<PipelineItem> item;
+    std::vector<size_t> indices;
+};
+
+// задержки запросов одной полосы: пары (задержка, число запросов)
+using LatencySamples = std::vector<std::pair<BatchStats::Duration, size_t>>;
+
+BatchStats::Lane MakeLaneStats(std::string_view name, LatencySamples& samples) {
+    BatchStats::Lane result{ name };
+    std::sort(samples.begin(), samples.end());
+    for (const auto& [latency, count] : samples) {
+        result.request_count += count;
+    }
+    if (result.request_count == 0) {
+        return result;
+    }
+    // Задержка, которую не превышает доля quantile запросов
+    const auto get_quantile = [&samples, total = result.request_count](double quantile) {
+        const auto rank = static_cast<size_t>(std::ceil(quantile * total));
+        size_t seen = 0;
+        for (const auto& [latency, count] : samples) {
+            seen += count;
+            if (seen >= rank) {
+                return latency;
             }
         }
-        return result;
+        return samples.back().first;
     };
-};
+    result.p50 = get_quantile(0.5);
+    result.p99 = get_quantile(0.99);
+    result.max = samples.back().first;
+    return result;
+}
 
-class StatQueryBus : public StatQuery {
+/*
+ * Конвейер из трёх стадий: поток разбора читает блоки из source и раскладывает их запросы
+ * по полосам типов, задачи полос выполняются в пуле потоков, а вызывающий поток выводит ответы
+ * в порядке запросов. Ответ выводится, как только выполнена полоса его запроса, поэтому поиски
+ * Stop и Bus не ждут, пока в том же блоке закончатся маршруты или карта. Пулу задача отдаётся, только когда для неё есть свободный поток,
+ * поэтому он получает задачу самой приоритетной полосы, в которой не исчерпан бюджет.
+ * Тяжёлые полосы (маршруты, Map и MapArea) вместе занимают не больше thread_count - 1 потоков,
+ * поэтому поиски Stop и Bus не ждут построения карты и деревьев маршрутов.
+ * Стадии ждут друг друга на условной переменной, не опрашивая очереди
+ */
+class StatPipeline {
 public:
-    StatQueryBus(int id, std::string_view name)
-        : StatQuery(id)
-        , name_(name) {
+    // pool может быть общим с другими конвейерами; thread_count ограничивает задачи этого конвейера
+    StatPipeline(parallel::ThreadPool& pool, size_t thread_count)
+        : pool_(pool)
+        , thread_count_(thread_count)
+        , heavy_budget_(std::max<size_t>(thread_count, 2) - 1)
+        , capacity_(thread_count * QUEUE_BLOCKS_PER_THREAD) {
+        for (size_t lane = 0; lane < LANE_COUNT; ++lane) {
+            // Карта строится один раз, поэтому больше одного потока ей не нужно
+            budgets_[lane] = LANE_NAMES[lane] == "Map"sv ? 1 : IsHeavyLane(lane) ? heavy_budget_ : thread_count;
+        }
     }
 
-    Node Process(const TransportCatalogue& db, const MapRenderer&, const TransportRouter&) const override {
-        const auto& response = db.GetBusStat(name_);
-        if (response.count_stops != 0) {
-            return Build(response);
-        }
-        return StatQuery::Build();
+    StatPipeline(const StatPipeline&) = delete;
+    StatPipeline& operator=(const StatPipeline&) = delete;
+
+    // Выполняет запросы из source и выводит ответы в writer. При ошибке любой стадии
+    // остальные останавливаются, а ожидание source прерывается вызовом interrupt
+    void Run(const StatContext& context, const StatSource& source, const std::function<void()>& interrupt,
+             Writer& writer, BatchStats& stats);
+    // Запускает в пуле помощника запроса тяжёлой полосы (см. parallel::Spawn), если для него
+    // есть свободный поток в бюджете тяжёлых полос и этот поток не ждут задачи лёгких полос
+    bool TrySpawn(std::function<void()> task);
+
+private:
+    parallel::ThreadPool& pool_;
+    const StatContext* context_ = nullptr;
+    size_t thread_count_;
+    size_t heavy_budget_;
+    // наибольшее число блоков между разбором и выводом
+    size_t capacity_;
+    std::array<size_t, LANE_COUNT> budgets_{};
+    // образец вложенного писателя для ответов: создавать его из основного во время вывода нельзя
+    std::optional<Writer> block_writer_;
+    const std::function<void()>* interrupt_ = nullptr;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    // задачи полос, ещё не отданные пулу
+    std::array<std::deque<LaneTask>, LANE_COUNT> lanes_;
+    std::array<size_t, LANE_COUNT> active_{};
+    size_t heavy_active_ = 0;
+    // задачи, отданные пулу и ещё не завершённые
+    size_t running_ = 0;
+    // разобранные и ещё не выведенные блоки в порядке чтения
+    std::deque<std::shared_ptr<PipelineItem>> items_;
+    bool is_parsed_ = false;
+    // первая ошибка стадий; после неё новые задачи не запускаются
+    std::exception_ptr error_;
+    BatchStats::Duration execute_time_{};
+    // задержки от разбора блока до вывода ответов; пишутся только выводящим потоком
+    std::array<LatencySamples, LANE_COUNT> latencies_;
+
+    void Parse(const StatSource& source, BatchStats::Duration& parse_time);
+    // Отдаёт пулу задачи полос, пока есть свободные потоки и бюджеты. Вызывается под mutex_
+    void Dispatch();
+    void Execute(size_t lane, const LaneTask& task);
+    void Fail(std::exception_ptr error);
+
+    // Выполнена ли полоса запроса index. Вызывается под mutex_
+    static bool IsExecuted(const PipelineItem& item, size_t index) {
+        return item.is_lane_done[GetLane(item.block->requests[index])];
     }
+};
+
+void StatPipeline::Run(const StatContext& context, const StatSource& source, const std::function<void()>& interrupt,
+                       Writer& writer, BatchStats& stats) {
+    context_ = &context;
+    interrupt_ = &interrupt;
+    block_writer_ = writer.Nested();
+    BatchStats::Duration parse_time{};
+    auto parser = std::async(std::launch::async, [this, &source, &parse_time] {
+        try {
+            Parse(source, parse_time);
+        }
+        catch (...) {
+            Fail(std::current_exception());
+        }
+    });
+
+    BatchStats::Duration serialize_time{};
+    try {
+        // номер первого невыведенного запроса в первом блоке items_
+        size_t next = 0;
+        while (true) {
+            std::shared_ptr<PipelineItem> item;
+            size_t end = next;
+            {
+                std::unique_lock lock(mutex_);
+                cv_.wait(lock, [this, next] {
+                    return error_ || (items_.empty() ? is_parsed_ : IsExecuted(*items_.front(), next));
+                });
+                if (error_ || items_.empty()) {
+                    break;
+                }
+                // Выводим все готовые подряд ответы: их полосы могли закончиться раньше, чем пришло уведомление
+                item = items_.front();
+                while (end < item->responses.size() && IsExecuted(*item, end)) {
+                    ++end;
+                }
+            }
 
-    class Factory : public StatQueryFactory {
-        std::unique_ptr<StatQuery> Create(const StatRequest& config) const override {
-            return std::make_unique<StatQueryBus>(config.id, config.params.at("name"sv));
+            const auto start = Clock::now();
+            WriteResponses(*context_, *item->block, item->responses, next, end, writer);
+            const auto finish = Clock::now();
+            serialize_time += finish - start;
+            std::array<size_t, LANE_COUNT> counts{};
+            for (size_t i = next; i < end; ++i) {
+                ++counts[GetLane(item->block->requests[i])];
+            }
+            for (size_t lane = 0; lane < LANE_COUNT; ++lane) {
+                if (counts[lane] > 0) {
+                    latencies_[lane].emplace_back(finish - item->parsed_at, counts[lane]);
+                }
+            }
+            stats.request_count += end - next;
+
+            next = end;
+            if (next == item->responses.size()) {
+                next = 0;
+                std::lock_guard lock(mutex_);
+                items_.pop_front();
+                // Освободилось место для следующего блока
+                cv_.notify_all();
+            }
         }
+    }
+    catch (...) {
+        Fail(std::current_exception());
+    }
+
+    // Задачи пула обращаются к конвейеру, поэтому дожидаемся всех
+    parser.wait();
+    std::unique_lock lock(mutex_);
+    cv_.wait(lock, [this] { return running_ == 0; });
+    if (error_) {
+        std::rethrow_exception(error_);
+    }
+
+    stats.stages = {
+        { "parse"sv, parse_time, 1 },
+        { "execute"sv, execute_time_, thread_count_ },
+        { "serialize"sv, serialize_time, 1 }
     };
-private:
-    std::string_view name_;
+    for (const size_t lane : LANE_PRIORITY) {
+        stats.lanes.push_back(MakeLaneStats(LANE_NAMES[lane], latencies_[lane]));
+    }
+}
+
+void StatPipeline::Parse(const StatSource& source, BatchStats::Duration& parse_time) {
+    while (true) {
+        {
+            std::unique_lock lock(mutex_);
+            cv_.wait(lock, [this] { return error_ || items_.size() < capacity_; });
+            if (error_) {
+                return;
+            }
+        }
+        auto item = std::make_shared<PipelineItem>();
+        item->block = std::make_unique<StatBlock>();
+        const auto start = Clock::now();
+        const bool has_block = source(*item->block);
+        item->parsed_at = Clock::now();
+        parse_time += item->parsed_at - start;
+        if (!has_block) {
+            break;
+        }
+
+        const auto& requests = item->block->requests;
+        item->responses.resize(requests.size());
+        std::array<std::vector<size_t>, LANE_COUNT> lanes;
+        for (size_t i = 0; i < requests.size(); ++i) {
+            lanes[GetLane(requests[i])].push_back(i);
+        }
 
-    Node Build(const catalog::BusStat& stat) const {
-        return Builder{}.StartDict()
-            .Key("request_id"s).Value(GetId())
-            .Key("curvature"s).Value(stat.curvature)
-            .Key("route_length"s).Value(stat.route_length)
-            .Key("stop_count"s).Value(stat.count_stops)
-            .Key("unique_stop_count"s).Value(stat.count_uniq_stops)
-            .EndDict().Build();
+        std::lock_guard lock(mutex_);
+        if (error_) {
+            return;
+        }
+        items_.push_back(item);
+        for (size_t lane = 0; lane < LANE_COUNT; ++lane) {
+            if (!lanes[lane].empty()) {
+                lanes_[lane].push_back({ item, std::move(lanes[lane]) });
+            }
+        }
+        Dispatch();
     }
-};
+    std::lock_guard lock(mutex_);
+    is_parsed_ = true;
+    cv_.notify_all();
+}
 
-class StatQueryMap : public StatQuery {
-public:
-    using StatQuery::StatQuery;
+void StatPipeline::Dispatch() {
+    for (const size_t lane : LANE_PRIORITY) {
+        auto& tasks = lanes_[lane];
+        while (running_ < thread_count_ && !tasks.empty() && active_[lane] < budgets_[lane]
+               && (!IsHeavyLane(lane) || heavy_active_ < heavy_budget_)) {
+            ++running_;
+            ++active_[lane];
+            if (IsHeavyLane(lane)) {
+                ++heavy_active_;
+            }
+            pool_.Submit([this, lane, task = std::move(tasks.front())] { Execute(lane, task); });
+            tasks.pop_front();
+        }
+    }
+}
+
+bool StatPipeline::TrySpawn(std::function<void()> task) {
+    std::lock_guard lock(mutex_);
+    if (error_ || running_ >= thread_count_ || heavy_active_ >= heavy_budget_) {
+        return false;
+    }
+    for (size_t lane = 0; lane < LANE_COUNT; ++lane) {
+        if (!IsHeavyLane(lane) && !lanes_[lane].empty()) {
+            return false;
+        }
+    }
+    ++running_;
+    ++heavy_active_;
+    pool_.Submit([this, task = std::move(task)] {
+        task();
+        std::lock_guard lock(mutex_);
+        --running_;
+        --heavy_active_;
+        if (!error_) {
+            Dispatch();
+        }
+        cv_.notify_all();
+    });
+    return true;
+}
+
+void StatPipeline::Execute(size_t lane, const LaneTask& task) {
+    PipelineItem& item = *task.item;
+    const auto start = Clock::now();
+    try {
+        Writer block_writer = *block_writer_;
+        ExecuteRequests(*context_, *item.block, task.indices, block_writer, item.responses);
+    }
+    catch (...) {
+        Fail(std::current_exception());
+    }
+    const auto finish = Clock::now();
 
-    Node Process(const TransportCatalogue& db, const MapRenderer& renderer, const TransportRouter&) const override {
-        std::ostringstream os;
-        renderer.RenderMap(db.GetRoutes()).Render(os);
-        return Build(os.str());
+    std::lock_guard lock(mutex_);
+    --running_;
+    --active_[lane];
+    if (IsHeavyLane(lane)) {
+        --heavy_active_;
+    }
+    execute_time_ += finish - start;
+    item.is_lane_done[lane] = true;
+    if (!error_) {
+        Dispatch();
     }
+    // Под мьютексом: после последней задачи Run может сразу разрушить конвейер
+    cv_.notify_all();
+}
 
-    class Factory : public StatQueryFactory {
-        std::unique_ptr<StatQuery> Create(const StatRequest& config) const override {
-            return std::make_unique<StatQueryMap>(config.id);
+void StatPipeline::Fail(std::exception_ptr error) {
+    {
+        std::lock_guard lock(mutex_);
+        if (error_) {
+            return;
         }
-    };
-private:
-    Node Build(std::string str) const {
-        return Builder{}.StartDict()
-            .Key("request_id"s).Value(GetId())
-            .Key("map"s).Value(std::move(str))
-            .EndDict().Build();
+        error_ = error;
+        for (auto& tasks : lanes_) {
+            tasks.clear();
+        }
+        cv_.notify_all();
     }
-};
+    // Поток разбора может ждать данных source
+    if (*interrupt_) {
+        (*interrupt_)();
+    }
+}
 
-class StatQueryRoute : public StatQuery {
-public:
-    StatQueryRoute(int id, std::string_view from, std::string_view to)
-        : StatQuery(id)
-        , from_(from)
-        , to_(to) {
+void RequestHandler::ProcessBaseQuery(std::vector<BaseRequest>& requests) {
+    BulkLoader::Counts counts;
+    for (const auto& request : requests) {
+        if (const auto* stop = std::get_if<StopRequest>(&request)) {
+            ++counts.stops;
+            counts.distances += stop->road_distances.size();
+        }
+        else if (std::holds_alternative<BusRequest>(request)) {
+            ++counts.buses;
+        }
     }
 
-    Node Process(const TransportCatalogue&, const MapRenderer&, const TransportRouter& router) const override {
-        const auto result = router.FindBestRoute(from_, to_);
-        if (result) {
-            return Build(*result);
+    BulkLoader loader(db_, counts);
+    std::vector<std::string_view> stops;
+    for (auto& request : requests) {
+        if (const auto* stop = std::get_if<StopRequest>(&request)) {
+            loader.AddStop(stop->name, stop->coordinates);
+            for (const auto& [to, dist] : stop->road_distances) {
+                loader.AddDistance(stop->name, to, dist);
+            }
+        }
+        else if (const auto* bus = std::get_if<BusRequest>(&request)) {
+            stops.assign(bus->stops.begin(), bus->stops.end());
+            loader.AddBus(bus->name, stops, bus->is_roundtrip);
         }
-        return StatQuery::Build();
+        // Строки запроса больше не нужны: каталог хранит свои копии
+        request = std::monostate{};
     }
+    loader.Finish();
+}
 
-    class Factory : public StatQueryFactory {
-        std::unique_ptr<StatQuery> Create(const StatRequest& config) const override {
-            return std::make_unique<StatQueryRoute>(config.id, config.params.at("from"sv), config.params.at("to"sv));
+BatchStats RequestHandler::ProcessStatQuery(const StatSource& source,
+                                            RenderSettings render_settings,
+                                            RoutingSettings routing_settings,
+                                            Writer& writer,
+                                            const std::function<void()>& interrupt) const
+{
+    const auto start = Clock::now();
+
+    // Конвейер создаётся раньше источников: его свободные потоки помогают рисовать карту
+    std::optional<StatPipeline> pipeline;
+    parallel::Spawn spawn;
+    if (pool_) {
+        pipeline.emplace(*pool_, thread_count_);
+        spawn = [&pipeline](std::function<void()> task) { return pipeline->TrySpawn(std::move(task)); };
+    }
+
+    // Рендерер и маршрутизатор создаются только при первом запросе, которому они нужны
+    const MapProvider maps(db_, std::move(render_settings), map_cache_, map_index_cache_,
+                           thread_count_, std::move(spawn));
+    const RouterProvider router(db_, routing_settings, router_cache_);
+    const StopIndexProvider stops(db_, stop_index_cache_);
+    const StatContext context{ db_, maps, router, stops };
+    BatchStats stats;
+
+    writer.StartArray();
+    try {
+        if (!pipeline) {
+            StatBlock block;
+            Writer block_writer = writer.Nested();
+            std::vector<size_t> indices;
+            std::vector<std::string> responses;
+            while (source(block)) {
+                indices.resize(block.requests.size());
+                std::iota(indices.begin(), indices.end(), 0);
+                responses.assign(block.requests.size(), {});
+                ExecuteRequests(context, block, indices, block_writer, responses);
+                WriteResponses(context, block, responses, 0, responses.size(), writer);
+                stats.request_count += block.requests.size();
+            }
         }
-    };
-private:
-    std::string_view from_;
-    std::string_view to_;
+        else {
+            pipeline->Run(context, source, interrupt, writer, stats);
+        }
+    }
+    catch (const std::exception& e) {
+        // Ответы выводятся целиком, поэтому массив можно закрыть: последним ответом будет ошибка
+        writer.StartDict().Key("error_message"sv).Value(e.what()).EndDict();
+        writer.EndArray();
+        throw;
+    }
+    writer.EndArray();
+
+    stats.renderer = maps.GetBuildTime();
+    stats.router = router.GetBuildTime();
+    stats.total = Clock::now() - start;
+    return stats;
+}
 
-    Node Build(const FoundRoute& route) const {
-        return Builder{}.StartDict()
-            .Key("request_id"s).Value(GetId())
-            .Key("total_time"s).Value(route.total_time)
-            .Key("items"s).Value(std::move(BuildArray(route.ways)))
-            .EndDict().Build();
+namespace stat_queries {
+
+void WriteNotFound(Writer& writer, int id) {
+    writer.StartDict()
+        .Key("request_id"sv).Value(id)
+        .Key("error_message"sv).Value("not found"sv)
+        .EndDict();
+}
+
+void WriteBuses(Writer& writer, int id, const std::set<std::string_view>* buses) {
+    writer.StartDict()
+        .Key("request_id"sv).Value(id)
+        .Key("buses"sv).StartArray();
+    if (buses) {
+        for (std::string_view str : *buses) {
+            writer.Value(str);
+        }
     }
+    writer.EndArray().EndDict();
+}
+
+void WriteBusStat(Writer& writer, int id, const catalog::BusStat& stat) {
+    writer.StartDict()
+        .Key("request_id"sv).Value(id)
+        .Key("curvature"sv).Value(stat.curvature)
+        .Key("route_length"sv).Value(stat.route_length)
+        .Key("stop_count"sv).Value(stat.count_stops)
+        .Key("unique_stop_count"sv).Value(stat.count_uniq_stops)
+        .EndDict();
+}
+
+// map_json — карта, уже сериализованная в строковый литерал JSON
+void WriteMap(Writer& writer, int id, std::string_view map_json) {
+    writer.StartDict()
+        .Key("request_id"sv).Value(id)
+        .Key("map"sv).RawValue(map_json)
+        .EndDict();
+}
+
+void WriteItemWait(Writer& writer, const Way& item) {
+    writer.StartDict()
+        .Key("type"sv).Value("Wait"sv)
+        .Key("stop_name"sv).Value(item.name)
+        .Key("time"sv).Value(item.time)
+        .EndDict();
+}
 
-    std::vector<Node> BuildArray(const std::vector<Way>& items) const {
-        std::vector<Node> result;
-        for (auto& item : items) {
-            result.push_back(item.span_count ? BuildItemBus(item) : BuildItemWait(item));
+void WriteItemBus(Writer& writer, const Way& item) {
+    writer.StartDict()
+        .Key("type"sv).Value("Bus"sv)
+        .Key("bus"sv).Value(item.name)
+        .Key("span_count"sv).Value(item.span_count)
+        .Key("time"sv).Value(item.time)
+        .EndDict();
+}
+
+// Пешая часть от точки отправления к остановке, от остановки к точке назначения или между точками
+void WriteItemWalk(Writer& writer, const Way& item) {
+    writer.StartDict()
+        .Key("type"sv).Value("Walk"sv);
+    if (!item.name.empty()) {
+        writer.Key("stop_name"sv).Value(item.name);
+    }
+    writer.Key("distance"sv).Value(item.distance)
+        .Key("time"sv).Value(item.time)
+        .EndDict();
+}
+
+void WriteRoute(Writer& writer, int id, const FoundRoute& route) {
+    writer.StartDict()
+        .Key("request_id"sv).Value(id)
+        .Key("total_time"sv).Value(route.total_time)
+        .Key("items"sv).StartArray();
+    for (auto& item : route.ways) {
+        if (item.is_walk) {
+            WriteItemWalk(writer, item);
         }
-        return result;
+        else if (item.span_count) {
+            WriteItemBus(writer, item);
+        }
+        else {
+            WriteItemWait(writer, item);
+        }
+    }
+    writer.EndArray().EndDict();
+}
+
+// Функции Process записывают ответ на запрос и возвращают false, если ответ — "not found"
+
+bool Process(const StatContext& context, int id, const StatRequest::Stop& query, Writer& writer) {
+    if (const auto& response = context.db.GetBusesByStop(query.name)) {
+        WriteBuses(writer, id, response.value());
+        return true;
     }
+    WriteNotFound(writer, id);
+    return false;
+}
 
-    Node BuildItemWait(const Way& item) const {
-        return Builder{}.StartDict()
-            .Key("type"s).Value("Wait"s)
-            .Key("stop_name"s).Value(std::string(item.name))
-            .Key("time").Value(item.time)
-            .EndDict().Build();
+bool Process(const StatContext& context, int id, const StatRequest::Bus& query, Writer& writer) {
+    const auto& response = context.db.GetBusStat(query.name);
+    if (response.count_stops != 0) {
+        WriteBusStat(writer, id, response);
+        return true;
     }
+    WriteNotFound(writer, id);
+    return false;
+}
 
-    Node BuildItemBus(const Way& item) const {
-        return Builder{}.StartDict()
-            .Key("type"s).Value("Bus"s)
-            .Key("bus"s).Value(std::string(item.name))
-            .Key("span_count"s).Value(item.span_count)
-            .Key("time").Value(item.time)
-            .EndDict().Build();
+bool Process(const StatContext& context, int id, const StatRequest::Map&, Writer& writer) {
+    const MapCache::Value map = context.maps.GetMapJson();
+    WriteMap(writer, id, *map);
+    return true;
+}
+
+void WriteRoute(Writer& writer, int id, const std::optional<FoundRoute>& route) {
+    if (route) {
+        WriteRoute(writer, id, *route);
+        return;
     }
-};
+    WriteNotFound(writer, id);
+}
 
-} // namespace stat_queries
+bool Process(const StatContext& context, int id, const StatRequest::Route& query, Writer& writer) {
+    const auto route = context.router.Get().FindBestRoute(query.from, query.to);
+    WriteRoute(writer, id, route);
+    return route.has_value();
+}
 
-const StatQueryFactory& StatQueryFactory::GetFactory(std::string_view type) {
-    static stat_queries::StatQueryStop::Factory stop;
-    static stat_queries::StatQueryBus::Factory bus;
-    static stat_queries::StatQueryMap::Factory map;
-    static stat_queries::StatQueryRoute::Factory route;
-
-    static std::unordered_map<std::string_view, const StatQueryFactory&> factories = {
-        { "Stop"sv, stop },
-        { "Bus"sv, bus },
-        { "Map"sv, map },
-        { "Route"sv, route }
-    };
-    return factories.at(type);
+bool Process(const StatContext& context, int id, const StatRequest::WalkRoute& query, Writer& writer) {
+    const auto route = context.router.Get().FindBestRoute(query.from, query.to, context.stops.Get());
+    WriteRoute(writer, id, route);
+    return route.has_value();
 }
 
-void BaseQueryHandler::Add(std::string_view name,
-                           geo::Coordinates coordinates,
-                           std::unordered_map<std::string_view, int> road_distances)
-{
-    base_queries_.push_front(std::make_unique<base_queries::QueryStop>(name, coordinates));
-    base_queries_.push_back(std::make_unique<base_queries::QueryStopDistance>(name, std::move(road_distances)));
+bool Process(const StatContext& context, int id, const StatRequest::MapArea& query, Writer& writer) {
+    const auto bounds = std::visit([&context](const auto& area) -> std::optional<GeoBounds> {
+        if constexpr (std::is_same_v<std::decay_t<decltype(area)>, Tile>) {
+            return context.maps.GetTileBounds(area);
+        }
+        else {
+            return area;
+        }
+    }, query.area);
+    if (!bounds) {
+        WriteNotFound(writer, id);
+        return false;
+    }
+    writer.StartDict()
+        .Key("request_id"sv).Value(id)
+        .Key("map"sv).RawValue(context.maps.RenderAreaJson(*bounds))
+        .EndDict();
+    return true;
 }
 
-void BaseQueryHandler::Add(std::string_view name,
-                           std::vector<std::string_view> stops,
-                           bool is_roundtrip) 
-{
-    base_queries_.push_back(std::make_unique<base_queries::QueryBus>(name, std::move(stops), is_roundtrip));
+bool Process(const StatContext& context, int id, const StatRequest::NearestStops& query, Writer& writer) {
+    writer.StartDict()
+        .Key("request_id"sv).Value(id)
+        .Key("stops"sv).StartArray();
+    for (const NearStop& near : context.stops.Get().Find(query.point, query.count, query.radius)) {
+        writer.StartDict()
+            .Key("name"sv).Value(near.stop->name)
+            .Key("distance"sv).Value(near.distance)
+            .EndDict();
+    }
+    writer.EndArray().EndDict();
+    return true;
 }
 
-void BaseQueryHandler::ProcessBaseQuery(TransportCatalogue& tc) const {
-    for (const auto& query : base_queries_) {
-        query->Process(tc);
+bool Process(const StatContext&, int id, const StatRequest::Invalid& query, Writer& writer) {
+    writer.StartDict();
+    if (query.has_id) {
+        writer.Key("request_id"sv).Value(id);
     }
+    writer.Key("error_message"sv).Value(query.message).EndDict();
+    return false;
+}
+
+bool Process(const StatContext&, int id, const StatRequest::Stats&, Writer& writer) {
+    if (!metrics::ENABLED) {
+        WriteNotFound(writer, id);
+        return false;
+    }
+    writer.StartDict().Key("request_id"sv).Value(id);
+    metrics::WriteStats(writer);
+    writer.EndDict();
+    return true;
+}
+
+} // namespace stat_queries
+
+bool ProcessStatRequest(const StatContext& context, const StatRequest& request, Writer& writer) {
+    return std::visit([&](const auto& query) {
+        return stat_queries::Process(context, request.id, query, writer);
+    }, request.query);
 }
 
 } // namespace handler
\ No newline at end of file
@@ -1,62 +1,242 @@
 #pragma once
-#include "json_builder.h"
+#include "json_writer.h"
 #include "map_renderer.h"
+#include "parallel.h"
+#include "stop_index.h"
 #include "transport_catalogue.h"
 #include "transport_router.h"
 
+#include <algorithm>
+#include <chrono>
 #include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
 
 namespace handler {
 
-class BaseQuery {
-public:
-    virtual ~BaseQuery() = default;
-    virtual void Process(catalog::TransportCatalogue& db) const = 0;
+// параметры запроса на добавление остановки
+struct StopRequest {
+    std::string name;
+    geo::Coordinates coordinates;
+    std::vector<std::pair<std::string, int>> road_distances;
+};
+
+// параметры запроса на добавление маршрута
+struct BusRequest {
+    std::string name;
+    std::vector<std::string> stops;
+    bool is_roundtrip = false;
 };
 
+// элемент base_requests; std::monostate у запросов неизвестного типа, которые пропускаются
+using BaseRequest = std::variant<std::monostate, StopRequest, BusRequest>;
+
+// статистика выполнения пакета stat-запросов
+struct BatchStats {
+    using Duration = std::chrono::duration<double>;
+
+    // стадия конвейера и суммарное время работы её потоков
+    struct Stage {
+        std::string_view name;
+        Duration busy{};
+        size_t thread_count = 0;
+    };
+
+    // задержка запросов полосы конвейера: от разбора блока до вывода ответа
+    struct Lane {
+        std::string_view name;
+        size_t request_count = 0;
+        Duration p50{};
+        Duration p99{};
+        Duration max{};
+    };
+
+    // время создания тяжёлых компонентов; nullopt, если компонент не понадобился
+    std::optional<Duration> renderer;
+    std::optional<Duration> router;
+    size_t request_count = 0;
+    Duration total{};
+    // пусты, если запросы выполнялись в одном потоке
+    std::vector<Stage> stages;
+    std::vector<Lane> lanes;
+};
+
+// параметры stat-запроса; строки ссылаются на данные, из которых запрос прочитан
 struct StatRequest {
-    std::unordered_map<std::string_view, std::string_view> params;
+    struct Stop {
+        std::string_view name;
+    };
+    struct Bus {
+        std::string_view name;
+    };
+    struct Map {};
+    struct Route {
+        std::string_view from;
+        std::string_view to;
+    };
+    // накопленные метрики процесса (см. metrics.h)
+    struct Stats {};
+    // часть карты: тайл или область в координатах
+    struct MapArea {
+        std::variant<renderer::Tile, renderer::GeoBounds> area;
+    };
+    // маршрут, у которого хотя бы одно место — точка; до остановок от неё идут пешком
+    struct WalkRoute {
+        routemap::Place from;
+        routemap::Place to;
+    };
+    // ближайшие к точке остановки: не больше count и не дальше radius метров
+    struct NearestStops {
+        geo::Coordinates point;
+        size_t count = 0;
+        double radius = 0.0;
+    };
+    // запрос, который не удалось разобрать; на него отвечают ошибкой message.
+    // has_id — удалось ли прочитать id запроса; без него ответ выводится без request_id
+    struct Invalid {
+        std::string_view message;
+        bool has_id = false;
+    };
+
     int id = 0;
+    std::variant<Stop, Bus, Map, Route, Stats, MapArea, NearestStops, WalkRoute, Invalid> query;
 };
 
-// вспомогательный класс для обработки BaseRequest
-class BaseQueryHandler {
-public:
-    friend class RequestHandler;
+// Число stat-запросов в блоке, которыми они передаются между стадиями конвейера
+inline constexpr size_t STAT_BLOCK_SIZE = 256;
 
-    template<typename Tuple>
-    void AddBaseQuery(const Tuple& params) {
-        const auto& [param1, param2, param3] = params;
-        Add(param1, param2, param3);
-    }
+// блок stat-запросов вместе со строками, на которые они ссылаются
+struct StatBlock {
+    std::vector<StatRequest> requests;
+    // deque не перемещает строки при добавлении, поэтому ссылки на них остаются верными
+    std::deque<std::string> strings;
+};
 
-protected:
-    void ProcessBaseQuery(catalog::TransportCatalogue& tc) const;
-    void Add(std::string_view name,
-             geo::Coordinates coordinates,
-             std::unordered_map<std::string_view, int> road_distances);
+// Заполняет блок очередными запросами (не больше STAT_BLOCK_SIZE).
+// Возвращает false, если запросы закончились
+using StatSource = std::function<bool(StatBlock&)>;
 
-    void Add(std::string_view name, 
-             std::vector<std::string_view> stops,
-             bool is_roundtrip);
+/*
+ * Кэш объектов, которые зависят только от данных каталога и настроек (карта, маршрутизатор).
+ * Для каждой пары (версия каталога, настройки) объект строится один раз
+ * и переиспользуется между пакетами запросов. Настройки хранятся вместе с объектом
+ * и сравниваются целиком, поэтому объект для других настроек не может быть выдан по ошибке
+ */
+template <typename T, typename Settings = std::monostate>
+class VersionedCache {
+public:
+    using Value = std::shared_ptr<const T>;
+
+    // Возвращает объект из кэша или строит его вызовом build.
+    // Параллельные запросы того же объекта дожидаются первого построения
+    Value Get(uint64_t version, const Settings& settings, const std::function<Value()>& build);
 
 private:
-    std::deque<std::unique_ptr<BaseQuery>> base_queries_;
+    struct Entry {
+        uint64_t version = 0;
+        Settings settings;
+        std::shared_future<Value> value;
+    };
+
+    std::mutex mutex_;
+    // объекты текущей и, пока их достраивают начатые раньше пакеты, более новых версий;
+    // настроек у одной версии обычно немного, поэтому поиск линейный
+    std::vector<Entry> entries_;
 };
 
+// карта, уже сериализованная в строковый литерал JSON
+using MapCache = VersionedCache<std::string, renderer::RenderSettings>;
+// индекс для запросов MapArea; от настроек не зависит
+using MapIndexCache = VersionedCache<renderer::MapIndex>;
+using RouterCache = VersionedCache<routemap::TransportRouter, routemap::RoutingSettings>;
+// индекс для запросов NearestStops и WalkRoute; от настроек не зависит
+using StopIndexCache = VersionedCache<catalog::StopIndex>;
+
+template <typename T, typename Settings>
+typename VersionedCache<T, Settings>::Value VersionedCache<T, Settings>::Get(
+        uint64_t version, const Settings& settings, const std::function<Value()>& build) {
+    const auto is_same = [version, &settings](const Entry& entry) {
+        return entry.version == version && entry.settings == settings;
+    };
+    std::promise<Value> promise;
+    std::shared_future<Value> value;
+    {
+        std::lock_guard lock(mutex_);
+        if (auto it = std::find_if(entries_.begin(), entries_.end(), is_same); it != entries_.end()) {
+            value = it->value;
+        }
+        else {
+            // Объекты прежних версий каталога больше не понадобятся
+            entries_.erase(std::remove_if(entries_.begin(), entries_.end(),
+                [version](const Entry& entry) { return entry.version < version; }), entries_.end());
+            entries_.push_back({ version, settings, promise.get_future().share() });
+        }
+    }
+    if (value.valid()) {
+        return value.get();
+    }
+
+    try {
+        Value result = build();
+        promise.set_value(result);
+        return result;
+    }
+    catch (...) {
+        promise.set_exception(std::current_exception());
+        // Неудачное построение не кэшируется
+        std::lock_guard lock(mutex_);
+        entries_.erase(std::remove_if(entries_.begin(), entries_.end(), is_same), entries_.end());
+        throw;
+    }
+}
+
 class RequestHandler {
 public:
-    RequestHandler(catalog::TransportCatalogue& catalogue)
-        : db_(catalogue) {
+    RequestHandler(catalog::TransportCatalogue& catalogue, size_t thread_count = parallel::GetThreadCount())
+        : db_(catalogue)
+        , thread_count_(std::max<size_t>(thread_count, 1)) {
+        if (thread_count_ > 1) {
+            pool_ = std::make_unique<parallel::ThreadPool>(thread_count_);
+        }
+    }
+
+    size_t GetThreadCount() const {
+        return thread_count_;
     }
 
-    void ProcessBaseQuery(const BaseQueryHandler& handler) const;
-    std::vector<json::Node> ProcessStatQuery(const std::vector<StatRequest>& requests,
-                                              renderer::RenderSettings render_settings,
-                                              routemap::RoutingSettings routing_settings) const;
+    // Загружает запросы в каталог в порядке их следования; ссылки на остановки,
+    // добавленные позже, разрешаются в конце загрузки. Загруженные запросы освобождаются
+    void ProcessBaseQuery(std::vector<BaseRequest>& requests);
+    // Выполняет запросы из source и записывает массив ответов в writer в порядке запросов.
+    // Разбор, выполнение и вывод идут конвейером: source вызывается в отдельном потоке,
+    // блоки выполняются в общем для всех вызовов пуле из thread_count потоков, а ответы выводятся в вызывающем.
+    // Если выполнение прервано исключением, массив всё равно закрывается: последним ответом
+    // становится ошибка без request_id. interrupt вызывается из любого потока, чтобы прервать
+    // ожидание source данных (например, закрыть сокет на чтение), если конвейер остановлен ошибкой.
+    // Рендерер, маршрутизатор и индекс остановок создаются, только если они нужны запросам, и переиспользуются
+    // последующими вызовами, пока каталог не изменится. Можно вызывать из нескольких потоков
+    BatchStats ProcessStatQuery(const StatSource& source,
+                                renderer::RenderSettings render_settings,
+                                routemap::RoutingSettings routing_settings,
+                                json::Writer& writer,
+                                const std::function<void()>& interrupt = {}) const;
 
 private:
     catalog::TransportCatalogue& db_;
+    size_t thread_count_;
+    // пул, в котором выполняются запросы всех пакетов; nullptr, если поток один
+    std::unique_ptr<parallel::ThreadPool> pool_;
+    mutable MapCache map_cache_;
+    mutable MapIndexCache map_index_cache_;
+    mutable RouterCache router_cache_;
+    mutable StopIndexCache stop_index_cache_;
 };
 
 } // namespace handler
@@ -6,7 +6,9 @@
 #include <cassert>
 #include <cstdint>
 #include <iterator>
+#include <functional>
 #include <optional>
+#include <queue>
 #include <stdexcept>
 #include <unordered_map>
 #include <utility>
@@ -114,4 +116,180 @@ std::optional<typename Router<Weight>::RouteInfo> Router<Weight>::BuildRoute(Ver
     return RouteInfo{weight, std::move(edges)};
 }
 
-}  // namespace graph
\ No newline at end of file
+// Кратчайшие маршруты из одной вершины во все остальные (алгоритм Дейкстры).
+// В отличие от Router, не требует предварительного расчёта всех пар вершин
+template <typename Weight>
+class ShortestPathTree {
+private:
+    using Graph = DirectedWeightedGraph<Weight>;
+
+public:
+    using RouteInfo = typename Router<Weight>::RouteInfo;
+
+    ShortestPathTree(const Graph& graph, VertexId from);
+
+    std::optional<RouteInfo> BuildRoute(VertexId to) const;
+
+    // Память, которую занимает дерево графа из vertex_count вершин
+    static size_t GetMemoryUsage(size_t vertex_count) {
+        return sizeof(ShortestPathTree) + vertex_count * sizeof(std::optional<VertexData>);
+    }
+
+private:
+    struct VertexData {
+        Weight weight;
+        std::optional<EdgeId> prev_edge;
+    };
+
+    const Graph& graph_;
+    std::vector<std::optional<VertexData>> vertices_;
+};
+
+template <typename Weight>
+ShortestPathTree<Weight>::ShortestPathTree(const Graph& graph, VertexId from)
+    : graph_(graph)
+    , vertices_(graph.GetVertexCount())
+{
+    using QueueItem = std::pair<Weight, VertexId>;
+    std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<QueueItem>> queue;
+
+    vertices_.at(from) = VertexData{Weight{}, std::nullopt};
+    queue.push({Weight{}, from});
+    while (!queue.empty()) {
+        const auto [weight, vertex] = queue.top();
+        queue.pop();
+        if (weight > vertices_[vertex]->weight) {
+            continue;
+        }
+        for (const EdgeId edge_id : graph.GetIncidentEdges(vertex)) {
+            const auto& edge = graph.GetEdge(edge_id);
+            if (edge.weight < Weight{}) {
+                throw std::domain_error("Edges' weights should be non-negative");
+            }
+            const Weight candidate_weight = weight + edge.weight;
+            auto& data = vertices_[edge.to];
+            if (!data || candidate_weight < data->weight) {
+                data = VertexData{candidate_weight, edge_id};
+                queue.push({candidate_weight, edge.to});
+            }
+        }
+    }
+}
+
+template <typename Weight>
+std::optional<typename ShortestPathTree<Weight>::RouteInfo> ShortestPathTree<Weight>::BuildRoute(
+    VertexId to) const {
+    const auto& data = vertices_.at(to);
+    if (!data) {
+        return std::nullopt;
+    }
+    std::vector<EdgeId> edges;
+    for (std::optional<EdgeId> edge_id = data->prev_edge;
+         edge_id;
+         edge_id = vertices_[graph_.GetEdge(*edge_id).from]->prev_edge)
+    {
+        edges.push_back(*edge_id);
+    }
+    std::reverse(edges.begin(), edges.end());
+
+    return RouteInfo{data->weight, std::move(edges)};
+}
+
+// вершина начала или конца маршрута и стоимость пути до неё (от неё)
+template <typename Weight>
+struct Terminal {
+    VertexId vertex;
+    Weight weight;
+};
+
+// маршрут между терминалами: номера терминалов начала и конца и рёбра между ними
+template <typename Weight>
+struct TerminalRouteInfo {
+    Weight weight;
+    size_t source;
+    size_t target;
+    std::vector<EdgeId> edges;
+};
+
+// Кратчайший маршрут из любого терминала sources в любой терминал targets с учётом их стоимостей —
+// как из виртуальной вершины, соединённой с sources, в виртуальную вершину, в которую ведут targets.
+// Выполняется один поиск Дейкстры из всех начал сразу; он останавливается, как только маршрут найден
+template <typename Weight>
+std::optional<TerminalRouteInfo<Weight>> FindShortestRoute(const DirectedWeightedGraph<Weight>& graph,
+                                                           const std::vector<Terminal<Weight>>& sources,
+                                                           const std::vector<Terminal<Weight>>& targets) {
+    struct VertexData {
+        Weight weight;
+        std::optional<EdgeId> prev_edge;
+        // терминал, с которого начинается путь в вершину
+        size_t source;
+    };
+    using QueueItem = std::pair<Weight, VertexId>;
+
+    // самый дешёвый терминал конца в каждой вершине
+    std::unordered_map<VertexId, size_t> target_by_vertex;
+    for (size_t i = 0; i < targets.size(); ++i) {
+        const auto [it, inserted] = target_by_vertex.emplace(targets[i].vertex, i);
+        if (!inserted && targets[i].weight < targets[it->second].weight) {
+            it->second = i;
+        }
+    }
+
+    std::vector<std::optional<VertexData>> vertices(graph.GetVertexCount());
+    std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<QueueItem>> queue;
+    for (size_t i = 0; i < sources.size(); ++i) {
+        auto& data = vertices.at(sources[i].vertex);
+        if (!data || sources[i].weight < data->weight) {
+            data = VertexData{sources[i].weight, std::nullopt, i};
+            queue.push({sources[i].weight, sources[i].vertex});
+        }
+    }
+
+    std::optional<std::pair<Weight, VertexId>> best;
+    while (!queue.empty()) {
+        const auto [weight, vertex] = queue.top();
+        queue.pop();
+        // Стоимости терминалов неотрицательны, поэтому более дальние вершины маршрут не улучшат
+        if (best && weight >= best->first) {
+            break;
+        }
+        if (weight > vertices[vertex]->weight) {
+            continue;
+        }
+        if (const auto it = target_by_vertex.find(vertex); it != target_by_vertex.end()) {
+            const Weight candidate_weight = weight + targets[it->second].weight;
+            if (!best || candidate_weight < best->first) {
+                best = { candidate_weight, vertex };
+            }
+        }
+        for (const EdgeId edge_id : graph.GetIncidentEdges(vertex)) {
+            const auto& edge = graph.GetEdge(edge_id);
+            if (edge.weight < Weight{}) {
+                throw std::domain_error("Edges' weights should be non-negative");
+            }
+            const Weight candidate_weight = weight + edge.weight;
+            auto& data = vertices[edge.to];
+            if (!data || candidate_weight < data->weight) {
+                data = VertexData{candidate_weight, edge_id, vertices[vertex]->source};
+                queue.push({candidate_weight, edge.to});
+            }
+        }
+    }
+    if (!best) {
+        return std::nullopt;
+    }
+
+    std::vector<EdgeId> edges;
+    for (std::optional<EdgeId> edge_id = vertices[best->second]->prev_edge;
+         edge_id;
+         edge_id = vertices[graph.GetEdge(*edge_id).from]->prev_edge)
+    {
+        edges.push_back(*edge_id);
+    }
+    std::reverse(edges.begin(), edges.end());
+
+    return TerminalRouteInfo<Weight>{best->first, vertices[best->second]->source,
+                                     target_by_vertex.at(best->second), std::move(edges)};
+}
+
+}  // namespace graph
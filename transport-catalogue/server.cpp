@@ -0,0 +1,208 @@
+#include "server.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace server {
+
+using namespace std::literals;
+
+namespace detail {
+
+// Размер буферов чтения и записи соединения
+constexpr size_t BUFFER_SIZE = 64 * 1024;
+// Пауза перед повтором accept после ошибки (например, кончились дескрипторы): начальная и наибольшая
+constexpr auto MIN_ACCEPT_DELAY = std::chrono::milliseconds(10);
+constexpr auto MAX_ACCEPT_DELAY = std::chrono::seconds(1);
+
+[[noreturn]] void ThrowSystemError(const char* what) {
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+// Буфер потоков ввода-вывода поверх дескриптора сокета
+class SocketBuf : public std::streambuf {
+public:
+    explicit SocketBuf(int fd)
+        : fd_(fd)
+        , input_(BUFFER_SIZE)
+        , output_(BUFFER_SIZE) {
+        setg(input_.data(), input_.data(), input_.data());
+        setp(output_.data(), output_.data() + output_.size());
+    }
+
+protected:
+    int_type underflow() override {
+        ssize_t size;
+        do {
+            size = ::read(fd_, input_.data(), input_.size());
+        } while (size < 0 && errno == EINTR);
+        if (size <= 0) {
+            return traits_type::eof();
+        }
+        setg(input_.data(), input_.data(), input_.data() + size);
+        return traits_type::to_int_type(input_[0]);
+    }
+
+    int_type overflow(int_type ch) override {
+        if (!Flush()) {
+            return traits_type::eof();
+        }
+        if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(ch);
+            pbump(1);
+        }
+        return traits_type::not_eof(ch);
+    }
+
+    int sync() override {
+        return Flush() ? 0 : -1;
+    }
+
+private:
+    int fd_;
+    std::vector<char> input_;
+    std::vector<char> output_;
+
+    bool Flush() {
+        const char* data = pbase();
+        while (data < pptr()) {
+            // MSG_NOSIGNAL: отключившийся клиент не должен завершать сервер сигналом SIGPIPE
+            const ssize_t size = ::send(fd_, data, pptr() - data, MSG_NOSIGNAL);
+            if (size < 0 && errno == EINTR) {
+                continue;
+            }
+            if (size <= 0) {
+                return false;
+            }
+            data += size;
+        }
+        setp(output_.data(), output_.data() + output_.size());
+        return true;
+    }
+};
+
+} // namespace detail
+
+using namespace detail;
+
+Server::Server(const json_reader::JsonReader& reader, std::string socket_path)
+    : reader_(reader)
+    , socket_path_(std::move(socket_path)) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socket_path_.size() >= sizeof(address.sun_path)) {
+        throw std::invalid_argument("Socket path is too long"s);
+    }
+    std::memcpy(address.sun_path, socket_path_.data(), socket_path_.size());
+
+    listen_fd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd_ < 0) {
+        ThrowSystemError("socket");
+    }
+    ::unlink(socket_path_.c_str());
+    if (::bind(listen_fd_, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0
+        || ::listen(listen_fd_, SOMAXCONN) < 0) {
+        const int error = errno;
+        ::close(listen_fd_);
+        errno = error;
+        ThrowSystemError("bind");
+    }
+}
+
+Server::~Server() {
+    ::close(listen_fd_);
+    ::unlink(socket_path_.c_str());
+}
+
+void Server::Run() {
+    std::chrono::milliseconds delay = MIN_ACCEPT_DELAY;
+    while (true) {
+        const int fd = ::accept(listen_fd_, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            // Нехватка дескрипторов или памяти проходит, когда закрываются соединения:
+            // ждём и повторяем, пока сервер не остановлен
+            std::unique_lock lock(mutex_);
+            if (cv_.wait_for(lock, delay, [this] { return is_stopped_; })) {
+                break;
+            }
+            delay = std::min<std::chrono::milliseconds>(delay * 2, MAX_ACCEPT_DELAY);
+            continue;
+        }
+        delay = MIN_ACCEPT_DELAY;
+
+        std::lock_guard lock(mutex_);
+        if (is_stopped_) {
+            ::close(fd);
+            break;
+        }
+        clients_.insert(fd);
+        std::thread([this, fd] { ServeClient(fd); }).detach();
+    }
+
+    std::unique_lock lock(mutex_);
+    cv_.wait(lock, [this] { return clients_.empty(); });
+}
+
+void Server::Stop() {
+    std::lock_guard lock(mutex_);
+    is_stopped_ = true;
+    cv_.notify_all();
+    // shutdown прерывает ожидающие accept и read в других потоках
+    ::shutdown(listen_fd_, SHUT_RDWR);
+    for (int fd : clients_) {
+        ::shutdown(fd, SHUT_RDWR);
+    }
+}
+
+void Server::ServeClient(int fd) {
+    SocketBuf buffer(fd);
+    std::istream in(&buffer);
+    std::ostream out(&buffer);
+
+    // Если выполнение пакета остановлено ошибкой, чтение запросов из сокета прерывается
+    const auto interrupt = [fd] { ::shutdown(fd, SHUT_RD); };
+    try {
+        // Пакеты читаются и обрабатываются по очереди, пока клиент не закроет соединение
+        while (in >> std::ws, in.peek() != std::istream::traits_type::eof()) {
+            reader_.ProcessStatBatch(in, out, interrupt);
+            out << '\n';
+            out.flush();
+        }
+    }
+    catch (const json_reader::BrokenBatchError&) {
+        // Ошибка уже выведена последним ответом массива, а граница следующего пакета неизвестна
+        out << '\n';
+        out.flush();
+    }
+    catch (const std::exception& e) {
+        // После ошибки разбора граница следующего пакета неизвестна, поэтому соединение закрывается
+        json::Writer writer(out);
+        writer.StartDict().Key("error_message"sv).Value(e.what()).EndDict();
+        writer.Finish();
+        out << '\n';
+        out.flush();
+    }
+
+    std::lock_guard lock(mutex_);
+    ::close(fd);
+    clients_.erase(fd);
+    cv_.notify_all();
+}
+
+} // namespace server
@@ -0,0 +1,50 @@
+#pragma once
+#include "json_reader.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <string>
+
+namespace server {
+
+/*
+ * Сервер stat-запросов на Unix domain socket. Каталог загружается один раз,
+ * а клиенты присылают пакеты {"stat_requests": [...]} друг за другом, не дожидаясь ответов.
+ * На каждый пакет в том же соединении отправляется массив ответов и перевод строки.
+ * На ошибочный запрос отвечают ошибкой в массиве; если после ошибки пакет не дочитать,
+ * она становится последним ответом массива и соединение закрывается.
+ * Каждое соединение читается и пишется своими потоками, а запросы всех соединений выполняются
+ * в общем пуле (см. handler::RequestHandler); каталог, карта и маршрутизатор тоже общие
+ */
+class Server {
+public:
+    // Создаёт сокет по пути socket_path, заменяя оставшийся от прежнего запуска файл
+    Server(const json_reader::JsonReader& reader, std::string socket_path);
+    // Закрывает сокет и удаляет его файл
+    ~Server();
+
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+
+    // Принимает соединения до вызова Stop и дожидается завершения всех клиентов
+    void Run();
+    // Прекращает приём соединений и разрывает открытые. Можно вызывать из другого потока
+    void Stop();
+
+private:
+    const json_reader::JsonReader& reader_;
+    std::string socket_path_;
+    int listen_fd_ = -1;
+
+    std::mutex mutex_;
+    // сигнализирует о закрытии соединения и об остановке сервера
+    std::condition_variable cv_;
+    // дескрипторы открытых соединений
+    std::set<int> clients_;
+    bool is_stopped_ = false;
+
+    void ServeClient(int fd);
+};
+
+} // namespace server
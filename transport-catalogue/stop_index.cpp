@@ -0,0 +1,187 @@
+#define _USE_MATH_DEFINES
+#include "stop_index.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace catalog {
+
+namespace detail {
+
+// Наибольшее число узлов поддерева, которое не делится дальше
+constexpr size_t LEAF_SIZE = 8;
+// Наибольшее число мест в ответе, выделяемое заранее
+constexpr size_t MAX_RESERVE = 64;
+
+double GetSquaredDistance(const std::array<double, 3>& lhs, const std::array<double, 3>& rhs) {
+    const double x = lhs[0] - rhs[0];
+    const double y = lhs[1] - rhs[1];
+    const double z = lhs[2] - rhs[2];
+    return x * x + y * y + z * z;
+}
+
+// Квадрат хорды единичной сферы, стягивающей дугу длиной distance метров
+double GetSquaredChord(double distance) {
+    const double angle = distance / geo::EARTH_RADIUS;
+    if (!(angle < M_PI)) {
+        // Хорда не длиннее диаметра
+        return std::numeric_limits<double>::infinity();
+    }
+    const double chord = 2 * std::sin(angle / 2);
+    return chord * chord;
+}
+
+// Длина дуги в метрах по квадрату стягивающей её хорды. Это то же расстояние по большому кругу,
+// что и geo::ComputeDistance, но вместо пяти тригонометрических функций вычисляется одна
+double GetArcLength(double squared_chord) {
+    return 2 * std::asin(std::min(std::sqrt(squared_chord) / 2, 1.0)) * geo::EARTH_RADIUS;
+}
+
+} // namespace detail
+
+/*
+ * Не больше count ближайших узлов, найденных к текущему моменту, в max-куче.
+ * Куча хранится прямо в ответе, в distance — квадрат хорды до остановки.
+ * Из узлов на равном расстоянии остаются первые по названию
+ */
+class StopIndex::Candidates {
+public:
+    Candidates(std::vector<NearStop>& heap, size_t count, double limit)
+        : heap_(heap)
+        , count_(count)
+        , limit_(limit) {
+    }
+
+    // Квадрат хорды, дальше которой узлы уже не нужны
+    double GetLimit() const {
+        return limit_;
+    }
+
+    void Add(double distance, const Stop* stop) {
+        if (distance > limit_) {
+            return;
+        }
+        const NearStop value{ stop, distance };
+        if (heap_.size() < count_) {
+            heap_.push_back(value);
+        }
+        else if (IsCloser(value, heap_.front())) {
+            std::pop_heap(heap_.begin(), heap_.end(), IsCloser);
+            heap_.back() = value;
+        }
+        else {
+            return;
+        }
+        std::push_heap(heap_.begin(), heap_.end(), IsCloser);
+        if (heap_.size() == count_) {
+            limit_ = heap_.front().distance;
+        }
+    }
+
+    // Упорядочивает найденные узлы по возрастанию расстояния и переводит его в метры
+    void Finish() {
+        std::sort_heap(heap_.begin(), heap_.end(), IsCloser);
+        for (NearStop& near : heap_) {
+            near.distance = detail::GetArcLength(near.distance);
+        }
+    }
+
+private:
+    std::vector<NearStop>& heap_;
+    size_t count_;
+    double limit_;
+
+    static bool IsCloser(const NearStop& lhs, const NearStop& rhs) {
+        return lhs.distance != rhs.distance ? lhs.distance < rhs.distance : lhs.stop->name < rhs.stop->name;
+    }
+};
+
+StopIndex::StopIndex(const std::vector<const Stop*>& stops) {
+    nodes_.reserve(stops.size());
+    for (const Stop* stop : stops) {
+        nodes_.push_back({ ToPoint(stop->coordinate), stop });
+    }
+    Build(0, nodes_.size());
+}
+
+std::vector<NearStop> StopIndex::Find(geo::Coordinates point, size_t count, double radius) const {
+    std::vector<NearStop> result;
+    if (count == 0 || nodes_.empty() || radius < 0) {
+        return result;
+    }
+
+    result.reserve(std::min({ count, nodes_.size(), detail::MAX_RESERVE }));
+    Candidates candidates(result, count, detail::GetSquaredChord(radius));
+    Search(0, nodes_.size(), ToPoint(point), candidates);
+    candidates.Finish();
+    return result;
+}
+
+size_t StopIndex::GetSize() const {
+    return nodes_.size();
+}
+
+StopIndex::Point StopIndex::ToPoint(geo::Coordinates coordinates) {
+    static const double dr = M_PI / 180.;
+    const double lat = coordinates.lat * dr;
+    const double lng = coordinates.lng * dr;
+    return { std::cos(lat) * std::cos(lng), std::cos(lat) * std::sin(lng), std::sin(lat) };
+}
+
+void StopIndex::Build(size_t begin, size_t end) {
+    if (end - begin <= detail::LEAF_SIZE) {
+        return;
+    }
+
+    // Поддерево делится по оси, вдоль которой его точки разбросаны сильнее всего
+    Point min = nodes_[begin].point;
+    Point max = min;
+    for (size_t i = begin + 1; i < end; ++i) {
+        for (size_t axis = 0; axis < 3; ++axis) {
+            min[axis] = std::min(min[axis], nodes_[i].point[axis]);
+            max[axis] = std::max(max[axis], nodes_[i].point[axis]);
+        }
+    }
+    uint8_t axis = 0;
+    for (uint8_t i = 1; i < 3; ++i) {
+        if (max[i] - min[i] > max[axis] - min[axis]) {
+            axis = i;
+        }
+    }
+
+    const size_t mid = begin + (end - begin) / 2;
+    std::nth_element(nodes_.begin() + begin, nodes_.begin() + mid, nodes_.begin() + end,
+        [axis](const Node& lhs, const Node& rhs) { return lhs.point[axis] < rhs.point[axis]; });
+    nodes_[mid].axis = axis;
+    Build(begin, mid);
+    Build(mid + 1, end);
+}
+
+void StopIndex::Search(size_t begin, size_t end, const Point& point, Candidates& candidates) const {
+    if (end - begin <= detail::LEAF_SIZE) {
+        for (size_t i = begin; i < end; ++i) {
+            candidates.Add(detail::GetSquaredDistance(point, nodes_[i].point), nodes_[i].stop);
+        }
+        return;
+    }
+
+    const size_t mid = begin + (end - begin) / 2;
+    const Node& node = nodes_[mid];
+    candidates.Add(detail::GetSquaredDistance(point, node.point), node.stop);
+    // Сначала обходится половина, в которой лежит точка; вторая — только если в ней могут быть узлы ближе
+    const double offset = point[node.axis] - node.point[node.axis];
+    if (offset < 0) {
+        Search(begin, mid, point, candidates);
+        if (offset * offset <= candidates.GetLimit()) {
+            Search(mid + 1, end, point, candidates);
+        }
+    }
+    else {
+        Search(mid + 1, end, point, candidates);
+        if (offset * offset <= candidates.GetLimit()) {
+            Search(begin, mid, point, candidates);
+        }
+    }
+}
+
+} // namespace catalog
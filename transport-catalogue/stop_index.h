@@ -0,0 +1,55 @@
+#pragma once
+#include "domain.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace catalog {
+
+// остановка и расстояние до неё в метрах по большому кругу, как в geo::ComputeDistance
+struct NearStop {
+    const Stop* stop = nullptr;
+    double distance = 0.0;
+};
+
+/*
+ * Пространственный индекс остановок: k-d дерево по точкам остановок на единичной сфере.
+ * Длина хорды между точками сферы монотонно растёт с расстоянием по дуге,
+ * поэтому ближайшие по хорде остановки — ближайшие и по geo::ComputeDistance
+ */
+class StopIndex {
+public:
+    explicit StopIndex(const std::vector<const Stop*>& stops);
+
+    // Не больше count ближайших к point остановок на расстоянии не больше radius метров,
+    // по возрастанию расстояния, при равных расстояниях — в порядке названий
+    std::vector<NearStop> Find(geo::Coordinates point, size_t count,
+                               double radius = std::numeric_limits<double>::infinity()) const;
+
+    size_t GetSize() const;
+
+private:
+    using Point = std::array<double, 3>;
+
+    struct Node {
+        Point point;
+        const Stop* stop = nullptr;
+        // ось, по которой делится поддерево с корнем в узле
+        uint8_t axis = 0;
+    };
+
+    class Candidates;
+
+    // узлы дерева: корень поддерева [begin, end) — его средний узел, меньшие по оси узлы левее.
+    // Поддеревья не больше LEAF_SIZE узлов не делятся и просматриваются целиком
+    std::vector<Node> nodes_;
+
+    static Point ToPoint(geo::Coordinates coordinates);
+    void Build(size_t begin, size_t end);
+    void Search(size_t begin, size_t end, const Point& point, Candidates& candidates) const;
+};
+
+} // namespace catalog
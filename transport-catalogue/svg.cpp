@@ -1,34 +1,38 @@
 #include "svg.h"
 
+#include <array>
+
 namespace svg {
 
 using namespace std::literals;
 
 namespace detail {
 
+// Замены символов в тексте и значениях атрибутов; пустая строка — символ выводится как есть
+constexpr std::array<std::string_view, 256> MakeHtmlEscapes() {
+    std::array<std::string_view, 256> escapes{};
+    escapes['"'] = "&quot;"sv;
+    escapes['\''] = "&apos;"sv;
+    escapes['<'] = "&lt;"sv;
+    escapes['>'] = "&gt;"sv;
+    escapes['&'] = "&amp;"sv;
+    return escapes;
+}
+
+constexpr std::array<std::string_view, 256> HTML_ESCAPES = MakeHtmlEscapes();
+
 void HtmlEncodeString(std::ostream& out, std::string_view str) {
-    for (auto c : str) {
-        switch (c) {
-        case'"':
-            out << "&quot;"sv;
-            break;
-        case'\'':
-            out << "&apos;"sv;
-            break;
-        case'<':
-            out << "&lt;"sv;
-            break;
-        case'>':
-            out << "&gt;"sv;
-            break;
-        case'&':
-            out << "&amp;"sv;
-            break;
-        default:
-            out.put(c);
-            break;
+    // Участки без спецсимволов выводятся целиком
+    size_t begin = 0;
+    for (size_t i = 0; i < str.size(); ++i) {
+        const std::string_view escape = HTML_ESCAPES[static_cast<unsigned char>(str[i])];
+        if (!escape.empty()) {
+            out.write(str.data() + begin, i - begin);
+            out << escape;
+            begin = i + 1;
         }
     }
+    out.write(str.data() + begin, str.size() - begin);
 }
 
 } // namespace detail
@@ -67,10 +71,21 @@ std::ostream& operator<<(std::ostream& os, const StrokeLineJoin line_join) {
     return os;
 }
 
+using detail::RenderOptionalAttr;
+using detail::RenderValue;
+
+void RenderPoint(std::ostream& out, Point p) {
+    RenderValue(out, p.x);
+    out << ',';
+    RenderValue(out, p.y);
+}
+
 void RenderRgb(std::ostream& out, const Rgb& rgb) {
-    out << static_cast<uint16_t>(rgb.red) << ','
-        << static_cast<uint16_t>(rgb.green) << ','
-        << static_cast<uint16_t>(rgb.blue);
+    RenderValue(out, static_cast<uint16_t>(rgb.red));
+    out << ',';
+    RenderValue(out, static_cast<uint16_t>(rgb.green));
+    out << ',';
+    RenderValue(out, static_cast<uint16_t>(rgb.blue));
 }
 
 void RenderColor(std::ostream& out, std::monostate) {
@@ -90,7 +105,9 @@ void RenderColor(std::ostream& out, const Rgb& rgb) {
 void RenderColor(std::ostream& out, const Rgba& rgba) {
     out << "rgba("sv;
     RenderRgb(out, rgba);
-    out << ',' << rgba.opacity << ')';
+    out << ',';
+    RenderValue(out, rgba.opacity);
+    out << ')';
 }
 
 std::ostream& operator<<(std::ostream& out, const Color color) {
@@ -104,7 +121,7 @@ void Object::Render(const RenderContext& context) const {
     // Делегируем вывод тега своим подклассам
     RenderObject(context);
 
-    context.out << std::endl;
+    context.out.put('\n');
 }
 
 Circle& Circle::SetCenter(Point center) {
@@ -119,8 +136,13 @@ Circle& Circle::SetRadius(double radius) {
 
 void Circle::RenderObject(const RenderContext& context) const {
     auto& out = context.out;
-    out << "<circle cx=\""sv << center_.x << "\" cy=\""sv << center_.y << "\" "sv;
-    out << "r=\""sv << radius_ << "\""sv;
+    out << "<circle cx=\""sv;
+    RenderValue(out, center_.x);
+    out << "\" cy=\""sv;
+    RenderValue(out, center_.y);
+    out << "\" r=\""sv;
+    RenderValue(out, radius_);
+    out << "\""sv;
     RenderAttrs(out);
     out << "/>"sv;
 }
@@ -141,7 +163,7 @@ void Polyline::RenderObject(const RenderContext& context) const {
         else {
             out << ' ';
         }
-        out << p.x << ',' << p.y;
+        RenderPoint(out, p);
     }
     out << '"';
     RenderAttrs(out);
@@ -158,7 +180,7 @@ Text& Text::SetOffset(Point offset) {
     return *this;
 }
 
-Text& Text::SetFontSize(uint32_t size) {
+Text& Text::SetFontSize(std::optional<uint32_t> size) {
     font_.size = size;
     return *this;
 }
@@ -180,9 +202,16 @@ Text& Text::SetData(std::string data) {
 
 void Text::RenderObject(const RenderContext& context) const {
     auto& out = context.out;
-    out << "<text x=\""sv << position_.x << "\" y=\""sv << position_.y << "\""sv
-        << " dx=\""sv << offset_.x << "\" dy=\""sv << offset_.y << "\""sv
-        << " font-size=\""sv << font_.size << "\""sv;
+    out << "<text x=\""sv;
+    RenderValue(out, position_.x);
+    out << "\" y=\""sv;
+    RenderValue(out, position_.y);
+    out << "\" dx=\""sv;
+    RenderValue(out, offset_.x);
+    out << "\" dy=\""sv;
+    RenderValue(out, offset_.y);
+    out << "\""sv;
+    RenderOptionalAttr(out, font_.size, " font-size="sv);
     if (!font_.family.empty()) {
         out << " font-family=\""sv << font_.family << "\""sv;
     }
@@ -195,18 +224,73 @@ void Text::RenderObject(const RenderContext& context) const {
     out << "</text>"sv;
 }
 
+Style& Style::AddRule(std::string name, std::string declarations) {
+    rules_.emplace_back(std::move(name), std::move(declarations));
+    return *this;
+}
+
+void Style::RenderObject(const RenderContext& context) const {
+    auto& out = context.out;
+    out << "<style>"sv;
+    for (const auto& [name, declarations] : rules_) {
+        out.put('.');
+        detail::HtmlEncodeString(out, name);
+        out.put('{');
+        detail::HtmlEncodeString(out, declarations);
+        out.put('}');
+    }
+    out << "</style>"sv;
+}
+
 void Document::AddPtr(std::unique_ptr<Object>&& obj) {
     objects_.push_back(std::move(obj));
 }
 
-void Document::Render(std::ostream& out) const {
+namespace detail {
+
+void RenderHeader(std::ostream& out) {
     out << "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n"sv;
     out << "<svg xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\">\n"sv;
+}
+
+void RenderFooter(std::ostream& out) {
+    out << "</svg>"sv;
+}
+
+} // namespace detail
+
+void Document::Render(std::ostream& out) const {
+    detail::RenderHeader(out);
     RenderContext ctx(out, 2, 2);
     for (auto& obj : objects_) {
         obj->Render(ctx);
     }
-    out << "</svg>"sv;
+    detail::RenderFooter(out);
+}
+
+StreamFragment::StreamFragment(std::ostream& out)
+    : context_(out, 2, 2) {
+}
+
+void StreamFragment::AddPtr(std::unique_ptr<Object>&& obj) {
+    obj->Render(context_);
+}
+
+void StreamFragment::AddObject(Object&& obj, MoveToHeap) {
+    obj.Render(context_);
+}
+
+StreamDocument::StreamDocument(std::ostream& out)
+    : StreamFragment(out) {
+    detail::RenderHeader(out);
+}
+
+void StreamDocument::AddFragment(std::string_view fragment) {
+    context_.out << fragment;
+}
+
+void StreamDocument::Finish() {
+    detail::RenderFooter(context_.out);
 }
 
 }  // namespace svg
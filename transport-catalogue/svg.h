@@ -1,10 +1,15 @@
 #pragma once
+#include "format.h"
+
 #include <cstdint>
 #include <iostream>
 #include <memory>
 #include <optional>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -50,6 +55,14 @@ struct Rgba : Rgb {
     double opacity = 1.0;
 };
 
+inline bool operator==(const Rgb& lhs, const Rgb& rhs) {
+    return lhs.red == rhs.red && lhs.green == rhs.green && lhs.blue == rhs.blue;
+}
+
+inline bool operator==(const Rgba& lhs, const Rgba& rhs) {
+    return static_cast<const Rgb&>(lhs) == rhs && lhs.opacity == rhs.opacity;
+}
+
 using Color = std::variant<std::monostate, std::string, Rgb, Rgba>;
 inline const Color NoneColor{};
 
@@ -57,10 +70,22 @@ std::ostream& operator<<(std::ostream& os, const Color color);
 
 namespace detail {
 
+template <typename Value>
+inline void RenderValue(std::ostream& out, const Value& value) {
+    if constexpr (std::is_arithmetic_v<Value>) {
+        format::WriteNumber(out, value);
+    }
+    else {
+        out << value;
+    }
+}
+
 template <typename AttrType>
 inline void RenderOptionalAttr(std::ostream& out, const std::optional<AttrType>& value, std::string_view name) {
     if (value) {
-        out << name << '"' << (*value) << '"';
+        out << name << '"';
+        RenderValue(out, *value);
+        out << '"';
     }
 }
 
@@ -94,14 +119,21 @@ public:
         return AsOwner();
     }
 
+    // Классы элемента через пробел, см. Style
+    Owner& SetClass(std::string name) {
+        class_ = std::move(name);
+        return AsOwner();
+    }
+
 protected:
     ~PathProps() = default;
 
-    // Метод RenderAttrs выводит в поток общие для всех путей атрибуты fill и stroke
+    // Метод RenderAttrs выводит в поток общие для всех путей атрибуты class, fill и stroke
     void RenderAttrs(std::ostream& out) const {
         using detail::RenderOptionalAttr;
         using namespace std::literals;
 
+        RenderOptionalAttr(out, class_, " class="sv);
         RenderOptionalAttr(out, fill_color_, " fill="sv);
         RenderOptionalAttr(out, stroke_color_, " stroke="sv);
         RenderOptionalAttr(out, stroke_width_, " stroke-width="sv);
@@ -121,6 +153,7 @@ private:
     std::optional<double> stroke_width_;
     std::optional<StrokeLineCap> stroke_linecap_;
     std::optional<StrokeLineJoin> stroke_linejoin_;
+    std::optional<std::string> class_;
 };
 
 struct Point {
@@ -133,6 +166,10 @@ struct Point {
     double y = 0.0;
 };
 
+inline bool operator==(Point lhs, Point rhs) {
+    return lhs.x == rhs.x && lhs.y == rhs.y;
+}
+
 /*
  * Вспомогательная структура, хранящая контекст для вывода SVG-документа с отступами.
  * Хранит ссылку на поток вывода, текущее значение и шаг отступа при выводе элемента
@@ -217,7 +254,8 @@ class Text final : public Object, public PathProps<Text> {
 public:
     Text& SetPosition(Point pos);
     Text& SetOffset(Point offset);
-    Text& SetFontSize(uint32_t size);
+    // nullopt — размер не выводится и задаётся стилем
+    Text& SetFontSize(std::optional<uint32_t> size);
     Text& SetFontFamily(std::string font_family);
     Text& SetFontWeight(std::string font_weight);
     Text& SetData(std::string data);
@@ -226,7 +264,7 @@ private:
     struct Font {
         std::string family;
         std::string weight;
-        uint32_t size = 1;
+        std::optional<uint32_t> size = 1;
     };
 
     Point position_;
@@ -237,6 +275,22 @@ private:
     void RenderObject(const RenderContext& context) const override;
 };
 
+/*
+ * Класс Style моделирует элемент <style> с CSS-правилами для классов элементов
+ * https://developer.mozilla.org/en-US/docs/Web/SVG/Element/style
+ */
+class Style final : public Object {
+public:
+    // Добавляет правило .name{declarations}; declarations — CSS-свойства через ';'.
+    // Из правил с равной специфичностью действует добавленное позже
+    Style& AddRule(std::string name, std::string declarations);
+
+private:
+    std::vector<std::pair<std::string, std::string>> rules_;
+
+    void RenderObject(const RenderContext& context) const override;
+};
+
 /*
  * Интерфейс, представляющий контейнер SVG объектов.
  */
@@ -244,16 +298,27 @@ class ObjectContainer {
 public:
     template<typename Obj>
     void Add(Obj obj) {
-        AddPtr(std::make_unique<Obj>(std::move(obj)));
+        AddObject(std::move(obj), [](Object&& object) -> std::unique_ptr<Object> {
+            return std::make_unique<Obj>(std::move(static_cast<Obj&>(object)));
+        });
     }
 
     // Добавляет в svg-документ объект-наследник svg::Object
     virtual void AddPtr(std::unique_ptr<Object>&&) = 0;
 
 protected:
+    // Переносит объект в кучу
+    using MoveToHeap = std::unique_ptr<Object> (*)(Object&&);
+
     // Интерфейс не предполагает полиморфное удаление
     // Поэтому деструктор объявлен защищённым невиртуальным
     ~ObjectContainer() = default;
+
+    // Добавляет объект, который существует только до конца вызова.
+    // По умолчанию объект переносится в кучу через move_to_heap и передаётся в AddPtr
+    virtual void AddObject(Object&& obj, MoveToHeap move_to_heap) {
+        AddPtr(move_to_heap(std::move(obj)));
+    }
 };
 
 /*
@@ -280,4 +345,40 @@ private:
     std::vector<std::unique_ptr<Object>> objects_;
 };
 
+/*
+ * Выводит каждый объект в поток сразу при добавлении, не сохраняя его,
+ * с отступом элементов документа. Фрагменты, выведенные в разные потоки,
+ * можно склеить по порядку в тело StreamDocument
+ */
+class StreamFragment : public ObjectContainer {
+public:
+    explicit StreamFragment(std::ostream& out);
+
+    StreamFragment(const StreamFragment&) = delete;
+    StreamFragment& operator=(const StreamFragment&) = delete;
+
+    void AddPtr(std::unique_ptr<Object>&& obj) override;
+
+protected:
+    RenderContext context_;
+
+    void AddObject(Object&& obj, MoveToHeap move_to_heap) override;
+};
+
+/*
+ * Документ, который выводит каждый объект в поток сразу при добавлении,
+ * не сохраняя его. Вывод совпадает с Document::Render для тех же объектов
+ */
+class StreamDocument final : public StreamFragment {
+public:
+    // Выводит в out заголовок svg-документа
+    explicit StreamDocument(std::ostream& out);
+
+    // Выводит объекты, уже выведенные StreamFragment
+    void AddFragment(std::string_view fragment);
+
+    // Выводит закрывающий тег; после этого объекты добавлять нельзя
+    void Finish();
+};
+
 }  // namespace svg
@@ -3,13 +3,20 @@
 #include <algorithm>
 #include <cassert>
 #include <iterator>
+#include <stdexcept>
 #include <utility>
 
 namespace catalog {
 
 void TransportCatalogue::AddBus(std::string_view bus_name, const std::vector<std::string_view>& stops, bool is_roundtrip) {
+    AddBus(MakeBus(bus_name, stops, is_roundtrip));
+}
+
+std::unique_ptr<Bus> TransportCatalogue::MakeBus(std::string_view bus_name,
+                                                 const std::vector<std::string_view>& stops,
+                                                 bool is_roundtrip) const {
     if (bus_name.empty() || stops.size() < 2) {
-        return;
+        return nullptr;
     }
     std::vector<const Stop*> route;
     route.reserve(stops.size());
@@ -20,33 +27,68 @@ void TransportCatalogue::AddBus(std::string_view bus_name, const std::vector<std
         route.push_back(it->second.get());
     }
 
-    auto bus = std::make_unique<Bus>(Bus{ std::string(bus_name), std::move(route), is_roundtrip });
+    return std::make_unique<Bus>(Bus{ std::string(bus_name), std::move(route), is_roundtrip });
+}
+
+void TransportCatalogue::AddBus(std::unique_ptr<Bus> bus) {
+    if (!bus) {
+        return;
+    }
     const Bus* bus_ptr = bus.get();
-    buses_.insert({ bus_ptr->name, std::move(bus)});
+    // Маршрут с тем же названием уже есть: новый не добавляется, и bus удаляется вместе с bus_ptr
+    if (!buses_.insert({ bus_ptr->name, std::move(bus)}).second) {
+        return;
+    }
+    ++version_;
 
     std::string_view name_bus = bus_ptr->name;
     for (auto stop : bus_ptr->stops) {
         stops_to_buses_[stop->name].insert(name_bus);
     }
+    if (bus_ptr->stops.empty()) {
+        return;
+    }
+    if (!route_bounds_) {
+        route_bounds_ = geo::Bounds{ bus_ptr->stops.front()->coordinate, bus_ptr->stops.front()->coordinate };
+    }
+    for (const Stop* stop : bus_ptr->stops) {
+        route_bounds_->Extend(stop->coordinate);
+    }
 }
 
 void TransportCatalogue::AddStop(std::string_view stop_name, const geo::Coordinates coordinates) {
+    AddStop(MakeStop(stop_name, coordinates));
+}
+
+std::unique_ptr<Stop> TransportCatalogue::MakeStop(std::string_view stop_name, const geo::Coordinates coordinates) {
     if (stop_name.empty()) {
+        return nullptr;
+    }
+    return std::make_unique<Stop>(Stop{ std::string(stop_name), coordinates });
+}
+
+void TransportCatalogue::AddStop(std::unique_ptr<Stop> stop) {
+    if (!stop) {
         return;
     }
-    assert(!stops_.count(stop_name));
-    auto stop = std::make_unique<Stop>(Stop{ std::string(stop_name), coordinates });
+    assert(!stops_.count(stop->name));
     stops_.insert({ stop.get()->name, std::move(stop)});
+    ++version_;
 }
 
 void TransportCatalogue::SetDistance(std::string_view from_stop, std::string_view to_stop, const int dist) {
     if (from_stop.empty() || to_stop.empty() || dist <= 0) {
         return;
     }
-    const Stop* from = GetStop(from_stop);
-    const Stop* to = GetStop(to_stop);
+    SetDistance(GetStop(from_stop), GetStop(to_stop), dist);
+}
 
+void TransportCatalogue::SetDistance(const Stop* from, const Stop* to, const int dist) {
+    if (!from || !to || dist <= 0) {
+        return;
+    }
     stop_distance_[{from, to}] = dist;
+    ++version_;
 
     auto it = stop_distance_.find({ to, from });
     if (it == stop_distance_.end()) {
@@ -54,6 +96,14 @@ void TransportCatalogue::SetDistance(std::string_view from_stop, std::string_vie
     }
 }
 
+void TransportCatalogue::Reserve(size_t stop_count, size_t bus_count, size_t distance_count) {
+    stops_.reserve(stop_count);
+    buses_.reserve(bus_count);
+    stops_to_buses_.reserve(stop_count);
+    // Для каждого расстояния может добавиться и обратное
+    stop_distance_.reserve(distance_count * 2);
+}
+
 std::set<const Bus*> TransportCatalogue::GetRoutes() const{
     std::set<const Bus*> result;
     std::transform(buses_.begin(), buses_.end(), std::inserter(result, result.end()),
@@ -108,6 +158,22 @@ size_t TransportCatalogue::GetStopsCount() const {
     return stops_.size();
 }
 
+std::vector<const Stop*> TransportCatalogue::GetStops() const {
+    std::vector<const Stop*> result;
+    result.reserve(stops_.size());
+    std::transform(stops_.begin(), stops_.end(), std::back_inserter(result),
+        [](const auto& stop) { return stop.second.get(); });
+    return result;
+}
+
+const std::optional<geo::Bounds>& TransportCatalogue::GetRouteBounds() const {
+    return route_bounds_;
+}
+
+uint64_t TransportCatalogue::GetVersion() const {
+    return version_;
+}
+
 int TransportCatalogue::GetDistance(const Stop* from, const Stop* to) const {
     auto it = stop_distance_.find({ from, to });
     return it == stop_distance_.end() ? 0 : it->second;
@@ -119,4 +185,71 @@ const Stop* TransportCatalogue::GetStop(std::string_view stop_name) const {
     return  it->second.get();
 }
 
-} // namespace catalog
\ No newline at end of file
+BulkLoader::BulkLoader(TransportCatalogue& db, Counts counts)
+    : db_(db) {
+    db_.Reserve(counts.stops, counts.buses, counts.distances);
+    buses_.reserve(counts.buses);
+    distances_.reserve(counts.distances);
+}
+
+const Stop* BulkLoader::ResolveStop(std::string_view name) {
+    if (const auto it = db_.stops_.find(name); it != db_.stops_.end()) {
+        return it->second.get();
+    }
+    if (const auto it = pending_stops_.find(name); it != pending_stops_.end()) {
+        return it->second.get();
+    }
+    auto stop = TransportCatalogue::MakeStop(name, {});
+    const Stop* result = stop.get();
+    pending_stops_.emplace(result->name, std::move(stop));
+    return result;
+}
+
+void BulkLoader::AddStop(std::string_view name, geo::Coordinates coordinates) {
+    if (name.empty()) {
+        return;
+    }
+    if (auto node = pending_stops_.extract(name)) {
+        node.mapped()->coordinate = coordinates;
+        db_.AddStop(std::move(node.mapped()));
+    }
+    else {
+        db_.AddStop(TransportCatalogue::MakeStop(name, coordinates));
+    }
+}
+
+void BulkLoader::AddDistance(std::string_view from, std::string_view to, int dist) {
+    if (from.empty() || to.empty() || dist <= 0) {
+        return;
+    }
+    distances_.push_back({ ResolveStop(from), ResolveStop(to), dist });
+}
+
+void BulkLoader::AddBus(std::string_view name, const std::vector<std::string_view>& stops, bool is_roundtrip) {
+    if (name.empty() || stops.size() < 2) {
+        return;
+    }
+    std::vector<const Stop*> route;
+    route.reserve(stops.size());
+    for (std::string_view stop : stops) {
+        route.push_back(ResolveStop(stop));
+    }
+    buses_.push_back(std::make_unique<Bus>(Bus{ std::string(name), std::move(route), is_roundtrip }));
+}
+
+void BulkLoader::Finish() {
+    if (!pending_stops_.empty()) {
+        throw std::invalid_argument("Unknown stop: " + pending_stops_.begin()->second->name);
+    }
+    // Все заготовки уже перешли в каталог, поэтому расстояния и маршруты ссылаются только на его остановки
+    for (const Distance& distance : distances_) {
+        db_.SetDistance(distance.from, distance.to, distance.dist);
+    }
+    distances_.clear();
+    for (auto& bus : buses_) {
+        db_.AddBus(std::move(bus));
+    }
+    buses_.clear();
+}
+
+} // namespace catalog
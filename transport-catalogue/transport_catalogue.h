@@ -1,6 +1,7 @@
 #pragma once
 #include "domain.h"
 
+#include <cstdint>
 #include <memory>
 #include <numeric>
 #include <optional>
@@ -34,12 +35,31 @@ private:
 
 class TransportCatalogue {
 public:
+    friend class BulkLoader;
+
     void AddBus(std::string_view bus_name, const std::vector<std::string_view>& stops, bool is_roundtrip);
     void AddStop(std::string_view stop_name, const geo::Coordinates coordinates);
     void SetDistance(std::string_view from_stop, std::string_view to_stop, const int dist);
+
+    // Двухфазное добавление: объекты создаются константными методами (их можно вызывать
+    // из нескольких потоков, пока каталог не изменяется), а затем добавляются последовательно
+    static std::unique_ptr<Stop> MakeStop(std::string_view stop_name, const geo::Coordinates coordinates);
+    std::unique_ptr<Bus> MakeBus(std::string_view bus_name, const std::vector<std::string_view>& stops, bool is_roundtrip) const;
+    void AddStop(std::unique_ptr<Stop> stop);
+    void AddBus(std::unique_ptr<Bus> bus);
+    void SetDistance(const Stop* from, const Stop* to, const int dist);
+    // Заранее выделяет место в таблицах под указанное число объектов
+    void Reserve(size_t stop_count, size_t bus_count, size_t distance_count);
+
     int GetDistance(const Stop* from, const Stop* to) const;
     size_t GetStopsCount() const;
+    // Все остановки каталога в произвольном порядке
+    std::vector<const Stop*> GetStops() const;
+    // Номер версии данных: увеличивается при каждом изменении каталога
+    uint64_t GetVersion() const;
     std::set<const Bus*> GetRoutes() const;
+    // Границы остановок, через которые проходят маршруты; nullopt, если маршрутов нет
+    const std::optional<geo::Bounds>& GetRouteBounds() const;
     const Stop* GetStop(std::string_view stop_name) const;
 
     BusStat GetBusStat(std::string_view bus_name) const;
@@ -56,6 +76,57 @@ private:
     std::unordered_map<std::string_view, std::unique_ptr<Bus>> buses_;
     std::unordered_map<std::string_view, std::set<std::string_view>> stops_to_buses_;
     std::unordered_map<std::pair<const Stop*, const Stop*>, int, Hasher> stop_distance_;
+    std::optional<geo::Bounds> route_bounds_;
+    uint64_t version_ = 0;
+};
+
+/*
+ * Пакетная загрузка каталога. Остановки, расстояния и маршруты можно добавлять в любом порядке:
+ * для остановки, на которую сослались раньше её добавления, создаётся заготовка,
+ * и расстояния и маршруты сразу ссылаются на неё. Когда остановка добавляется,
+ * заготовка переходит в каталог, сохраняя адрес. Остановки попадают в каталог сразу,
+ * а расстояния и маршруты — только в Finish, после проверки, что все остановки,
+ * на которые есть ссылки, добавлены
+ */
+class BulkLoader {
+public:
+    // ожидаемое число объектов; по нему заранее выделяется место в таблицах каталога
+    struct Counts {
+        size_t stops = 0;
+        size_t buses = 0;
+        size_t distances = 0;
+    };
+
+    BulkLoader(TransportCatalogue& db, Counts counts);
+
+    BulkLoader(const BulkLoader&) = delete;
+    BulkLoader& operator=(const BulkLoader&) = delete;
+
+    void AddStop(std::string_view name, geo::Coordinates coordinates);
+    void AddDistance(std::string_view from, std::string_view to, int dist);
+    void AddBus(std::string_view name, const std::vector<std::string_view>& stops, bool is_roundtrip);
+
+    // Завершает загрузку: добавляет в каталог расстояния и маршруты. Бросает std::invalid_argument,
+    // если на какую-то остановку ссылаются расстояния или маршруты, но сама она не добавлена;
+    // тогда в каталоге остаются только добавленные остановки
+    void Finish();
+
+private:
+    struct Distance {
+        const Stop* from = nullptr;
+        const Stop* to = nullptr;
+        int dist = 0;
+    };
+
+    TransportCatalogue& db_;
+    // заготовки остановок, на которые уже есть ссылки
+    std::unordered_map<std::string_view, std::unique_ptr<Stop>> pending_stops_;
+    // расстояния и маршруты, которые добавляются в каталог в Finish
+    std::vector<Distance> distances_;
+    std::vector<std::unique_ptr<Bus>> buses_;
+
+    // Возвращает остановку каталога или заготовку для неё
+    const Stop* ResolveStop(std::string_view name);
 };
 
 template<typename Iterator>
@@ -1,15 +1,29 @@
+#include "metrics.h"
 #include "transport_router.h"
 
+#include <algorithm>
+#include <limits>
+
 namespace routemap {
 
 using namespace graph;
 using namespace catalog;
 
+bool operator==(const RoutingSettings& lhs, const RoutingSettings& rhs) {
+    return lhs.bus_velocity == rhs.bus_velocity && lhs.bus_wait_time == rhs.bus_wait_time
+        && lhs.walk_velocity == rhs.walk_velocity && lhs.walk_distance == rhs.walk_distance;
+}
+
 double TransportRouter::ComputeTravelTime(int dist) const {
     constexpr double mpm = 60. / 1000;
     return dist / settings_.bus_velocity * mpm;
 }
 
+double TransportRouter::ComputeWalkTime(double distance) const {
+    constexpr double mpm = 60. / 1000;
+    return distance / settings_.walk_velocity * mpm;
+}
+
 void TransportRouter::AddEdge(graph::VertexId id1, graph::VertexId id2, Way item) {
     EdgeId edge_id = graph_.AddEdge({ id1, id2, item.time });
     items_[edge_id] = std::move(item);
@@ -53,30 +67,130 @@ void TransportRouter::BuildGraph(const TransportCatalogue& db) {
             }
         }
     }
-    router_.emplace(Router<double>(graph_));
 }
 
 TransportRouter::TransportRouter(RoutingSettings setting, const catalog::TransportCatalogue& db) 
     : settings_(setting)
     , graph_(db.GetStopsCount() * 2) {
+    const metrics::ScopedTiming timing(metrics::Timing::GRAPH_BUILD);
     BuildGraph(db);
+    max_trees_ = std::max<size_t>(MAX_TREES_MEMORY / Tree::GetMemoryUsage(graph_.GetVertexCount()), 1);
+}
+
+TransportRouter::RoutesFrom TransportRouter::GetRoutesFrom(std::string_view from) const {
+    const auto vertex = GetVertexId(from);
+    if (!vertex) {
+        return { *this, nullptr };
+    }
+
+    std::shared_ptr<TreeEntry> entry;
+    {
+        std::lock_guard lock(trees_mutex_);
+        if (const auto it = trees_.find(*vertex); it != trees_.end()) {
+            tree_order_.splice(tree_order_.begin(), tree_order_, it->second.position);
+            entry = it->second.entry;
+        }
+        else {
+            if (trees_.size() == max_trees_) {
+                trees_.erase(tree_order_.back());
+                tree_order_.pop_back();
+            }
+            entry = std::make_shared<TreeEntry>();
+            tree_order_.push_front(*vertex);
+            trees_.emplace(*vertex, CachedTree{ entry, tree_order_.begin() });
+        }
+    }
+    // Дерево строится вне общей блокировки, чтобы не задерживать запросы из других остановок
+    std::call_once(entry->once, [this, &entry, vertex] {
+        const metrics::ScopedTiming timing(metrics::Timing::ROUTER_PRECOMPUTE);
+        entry->tree.emplace(graph_, *vertex);
+    });
+    const Tree& tree = *entry->tree;
+    return { *this, std::shared_ptr<const Tree>(std::move(entry), &tree) };
 }
 
 std::optional<FoundRoute> TransportRouter::FindBestRoute(std::string_view from, std::string_view to) const {
-    auto stop_from = GetVertexId(from);
-    auto stop_to = GetVertexId(to);
-    if (!stop_from || !stop_to) {
+    return GetRoutesFrom(from).To(to);
+}
+
+std::optional<FoundRoute> TransportRouter::FindBestRoute(const Place& from, const Place& to,
+                                                         const StopIndex& stops) const {
+    std::optional<FoundRoute> result;
+    const auto* from_point = std::get_if<geo::Coordinates>(&from);
+    const auto* to_point = std::get_if<geo::Coordinates>(&to);
+    if (from_point && to_point) {
+        const double distance = geo::ComputeDistance(*from_point, *to_point);
+        if (distance <= settings_.walk_distance) {
+            result = FoundRoute{ ComputeWalkTime(distance), { MakeWalk({}, distance) } };
+        }
+    }
+
+    const std::vector<WalkLeg> from_legs = GetWalkLegs(from, stops);
+    const std::vector<WalkLeg> to_legs = GetWalkLegs(to, stops);
+    const auto route = FindShortestRoute(graph_, MakeTerminals(from_legs), MakeTerminals(to_legs));
+    if (!route || (result && result->total_time <= route->weight)) {
+        return result;
+    }
+
+    std::vector<Way> items;
+    if (const WalkLeg& leg = from_legs[route->source]; leg.distance > 0) {
+        items.push_back(MakeWalk(leg.stop, leg.distance));
+    }
+    for (EdgeId id : route->edges) {
+        items.push_back(items_.at(id));
+    }
+    if (const WalkLeg& leg = to_legs[route->target]; leg.distance > 0) {
+        items.push_back(MakeWalk(leg.stop, leg.distance));
+    }
+    return FoundRoute{ route->weight, std::move(items) };
+}
+
+std::vector<TransportRouter::WalkLeg> TransportRouter::GetWalkLegs(const Place& place, const StopIndex& stops) const {
+    std::vector<WalkLeg> result;
+    if (const auto* name = std::get_if<std::string_view>(&place)) {
+        if (const auto vertex = GetVertexId(*name)) {
+            result.push_back({ *name, *vertex });
+        }
+        return result;
+    }
+    const auto near_stops = stops.Find(std::get<geo::Coordinates>(place), std::numeric_limits<size_t>::max(),
+                                       settings_.walk_distance);
+    for (const NearStop& near : near_stops) {
+        // Остановки, через которые не проходят маршруты, в граф не входят
+        if (const auto vertex = GetVertexId(near.stop->name)) {
+            result.push_back({ near.stop->name, *vertex, near.distance });
+        }
+    }
+    return result;
+}
+
+std::vector<Terminal<double>> TransportRouter::MakeTerminals(const std::vector<WalkLeg>& legs) const {
+    std::vector<Terminal<double>> result;
+    result.reserve(legs.size());
+    for (const WalkLeg& leg : legs) {
+        result.push_back({ leg.vertex, ComputeWalkTime(leg.distance) });
+    }
+    return result;
+}
+
+Way TransportRouter::MakeWalk(std::string_view stop, double distance) const {
+    return { stop, 0, ComputeWalkTime(distance), true, distance };
+}
+
+std::optional<FoundRoute> TransportRouter::RoutesFrom::To(std::string_view to) const {
+    const auto stop_to = router_.GetVertexId(to);
+    if (!tree_ || !stop_to) {
         return {};
     }
 
-    const auto route = router_->BuildRoute(*stop_from, *stop_to);
+    const auto route = tree_->BuildRoute(*stop_to);
     if (!route) {
         return {};
     }
 
     std::vector<Way> items;
     for (EdgeId id : route->edges) {
-        items.push_back(items_.at(id));
+        items.push_back(router_.items_.at(id));
     }
     return { { route->weight, items } };
 }
@@ -1,40 +1,125 @@
 #include "router.h"
+#include "stop_index.h"
 #include "transport_catalogue.h"
 
+#include <list>
+#include <memory>
+#include <mutex>
+#include <variant>
+
 namespace routemap {
 
 struct  RoutingSettings {
     double bus_velocity;
     int bus_wait_time;
+    // скорость пешехода, км/ч
+    double walk_velocity = 5.0;
+    // наибольшее расстояние, которое проходят пешком от точки до остановки, м
+    double walk_distance = 500.0;
 };
 
+// Маршрутизаторы с равными настройками совпадают
+bool operator==(const RoutingSettings& lhs, const RoutingSettings& rhs);
+
 struct Way {
     std::string_view name;
     int span_count{};
     double time{};
+    // Пешая часть маршрута: name — остановка, к которой идут от точки отправления
+    // или от которой идут к точке назначения; пусто, если идут сразу к точке назначения
+    bool is_walk = false;
+    double distance{};
 };
 
+// место отправления или прибытия: название остановки или точка
+using Place = std::variant<std::string_view, geo::Coordinates>;
+
 struct FoundRoute {
     double total_time;
     std::vector<Way> ways;
 };
 
+/*
+ * Поиск маршрутов между остановками. Кратчайшие пути из остановки ищутся при первом запросе
+ * маршрута из неё и сохраняются, поэтому маршруты из одной остановки ищутся по одному дереву.
+ * Сохранённые деревья занимают не больше MAX_TREES_MEMORY байт: давно не использованные вытесняются.
+ * Методы можно вызывать из нескольких потоков одновременно
+ */
 class TransportRouter {
+private:
+    using Tree = graph::ShortestPathTree<double>;
+
 public:
+    // Маршруты из одной остановки
+    class RoutesFrom {
+    public:
+        std::optional<FoundRoute> To(std::string_view to) const;
+
+    private:
+        friend class TransportRouter;
+
+        RoutesFrom(const TransportRouter& router, std::shared_ptr<const Tree> tree)
+            : router_(router)
+            , tree_(std::move(tree)) {
+        }
+
+        const TransportRouter& router_;
+        // nullptr, если остановки нет в графе. Вытесненное из маршрутизатора дерево живёт, пока нужно здесь
+        std::shared_ptr<const Tree> tree_;
+    };
+
+    // Наибольший объём сохранённых деревьев кратчайших путей; одно дерево сохраняется всегда
+    static constexpr size_t MAX_TREES_MEMORY = size_t{ 128 } << 20;
+
     TransportRouter(RoutingSettings setting, const catalog::TransportCatalogue& db);
 
+    RoutesFrom GetRoutesFrom(std::string_view from) const;
     std::optional<FoundRoute> FindBestRoute(std::string_view from, std::string_view to) const;
+    // Лучший маршрут между местами. От точки идут пешком до остановок не дальше walk_distance
+    // (их ищут в stops), а если обе точки ближе друг к другу, то можно дойти пешком сразу.
+    // Все варианты начала и конца рассматриваются одним поиском по графу
+    std::optional<FoundRoute> FindBestRoute(const Place& from, const Place& to,
+                                            const catalog::StopIndex& stops) const;
 
 private:
+    // остановка, с которой место связано пешим путём, и длина пути в метрах
+    struct WalkLeg {
+        std::string_view stop;
+        graph::VertexId vertex = 0;
+        double distance = 0.0;
+    };
+
+    struct TreeEntry {
+        std::once_flag once;
+        std::optional<Tree> tree;
+    };
+
+    // сохранённое дерево и его место в tree_order_
+    struct CachedTree {
+        std::shared_ptr<TreeEntry> entry;
+        std::list<graph::VertexId>::iterator position;
+    };
+
     RoutingSettings settings_;
     std::unordered_map<std::string_view, graph::VertexId> dict_vertices_;
     std::unordered_map<graph::EdgeId, Way> items_;
-    std::optional<graph::Router<double>> router_;
     graph::DirectedWeightedGraph<double> graph_;
+    // деревья кратчайших путей по вершине отправления
+    mutable std::mutex trees_mutex_;
+    mutable std::unordered_map<graph::VertexId, CachedTree> trees_;
+    // вершины отправления сохранённых деревьев, недавно использованные — в начале
+    mutable std::list<graph::VertexId> tree_order_;
+    // сколько деревьев помещается в MAX_TREES_MEMORY
+    size_t max_trees_ = 1;
 
     std::pair<bool, graph::VertexId> AssignVertexId(std::string_view name);
     std::optional<graph::VertexId> GetVertexId(std::string_view name) const;
     double ComputeTravelTime(int dist) const;
+    double ComputeWalkTime(double distance) const;
+    // Пешие части, которыми место связано с остановками графа; у остановки — одна часть нулевой длины
+    std::vector<WalkLeg> GetWalkLegs(const Place& place, const catalog::StopIndex& stops) const;
+    std::vector<graph::Terminal<double>> MakeTerminals(const std::vector<WalkLeg>& legs) const;
+    Way MakeWalk(std::string_view stop, double distance) const;
     void AddEdge(graph::VertexId id1, graph::VertexId id2, Way);
     void BuildGraph(const catalog::TransportCatalogue& db);
 };